@@ -0,0 +1,393 @@
+/*
+ * stl_import_benchmark.cpp
+ *
+ * Measures import, mesh build and export throughput over the STLs in
+ * tests/test_data plus large synthetic STLs, and writes the results as JSON
+ * so that runs can be compared to track regressions.
+ *
+ * usage: stl_import_benchmark [--data-dir dir] [--facets n] [--shape shape]
+ *                             [--iterations n] [--threads n] [--output file.json] [--help]
+ *
+ * The synthetic STLs come from stl_generator (a sphere by default).
+ */
+
+#include "stl_importer.h"
+#include "stl_exporter.h"
+#include "stl_generator.h"
+#include "stl_import.h"
+#include "triangle_mesh.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+
+struct benchmark_result
+{
+	string	name;			// what was measured
+	string	input;			// file it was measured on
+	string	format;			// "ascii" or "binary"
+	size_t	bytes = 0;		// bytes read or written per iteration
+	size_t	facets = 0;		// facets processed per iteration
+	double	best_seconds = 0.0;
+	double	mean_seconds = 0.0;
+	size_t	peak_rss_kb = 0;	// process high-water mark after the benchmark
+};
+
+struct benchmark_options
+{
+	string		data_dir = "./test_data";
+	size_t		synthetic_facets = 1000000;
+	stl_util::generated_shape	synthetic_shape = stl_util::generated_shape::sphere;
+	unsigned	iterations = 3;
+	unsigned	num_threads = 0;	// 0 = hardware concurrency
+	string		output;				// empty = stdout
+};
+
+size_t peak_rss_kb()
+{
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+	return (size_t) usage.ru_maxrss;	// kilobytes on Linux
+}
+
+/** Runs func iterations times, timing each run.
+ *  func returns the number of facets it processed.
+ */
+template <typename Func>
+benchmark_result run_benchmark(const string& name, const string& input, const string& format,
+							   size_t bytes, unsigned iterations, Func func)
+{
+	benchmark_result result;
+	result.name = name;
+	result.input = input;
+	result.format = format;
+	result.bytes = bytes;
+
+	double total_seconds = 0.0;
+	for (unsigned i = 0 ; i < iterations ; i++)
+	{
+		const auto start = chrono::steady_clock::now();
+		result.facets = func();
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		total_seconds += seconds;
+		if (i == 0 || seconds < result.best_seconds)
+			result.best_seconds = seconds;
+	}
+
+	result.mean_seconds = iterations > 0 ? total_seconds / iterations : 0.0;
+	result.peak_rss_kb = peak_rss_kb();
+
+	cerr << name << " (" << input << "): " << result.best_seconds * 1000.0 << " ms" << endl;
+
+	return result;
+}
+
+bool is_ascii_stl(const string& filename)
+{
+	return stl_util::stl_importer(filename).is_ascii();
+}
+
+void benchmark_file(const string& filename, const benchmark_options& options, vector<benchmark_result>& results)
+{
+	const string input = filesystem::path(filename).filename().string();
+	const size_t bytes = (size_t) filesystem::file_size(filename);
+	const bool ascii = is_ascii_stl(filename);
+	const string format = ascii ? "ascii" : "binary";
+	const unsigned num_threads = options.num_threads > 0 ? options.num_threads : std::max(1u, thread::hardware_concurrency());
+
+	vector<maths::triangle3d> triangles;
+
+	results.push_back(run_benchmark("stl_importer", input, format, bytes, options.iterations, [&]()
+	{
+		stl_util::stl_importer importer(filename);
+		triangles.clear();
+		importer.import(back_inserter(triangles));
+		return triangles.size();
+	}));
+
+	results.push_back(run_benchmark("stl_importer_read_ahead", input, format, bytes, options.iterations, [&]()
+	{
+		stl_util::stl_importer importer(filename, stl_util::facet_count_mode::exact, stl_util::io_mode::read_ahead);
+
+		vector<maths::triangle3d> read_ahead_triangles;
+		importer.import(back_inserter(read_ahead_triangles));
+		return read_ahead_triangles.size();
+	}));
+
+	if (num_threads > 1)
+	{
+		results.push_back(run_benchmark("stl_importer_mt", input, format, bytes, options.iterations, [&]()
+		{
+			stl_util::stl_importer importer(filename);
+			importer.set_num_threads(num_threads);
+
+			vector<maths::triangle3d> mt_triangles;
+			importer.import(back_inserter(mt_triangles));
+			return mt_triangles.size();
+		}));
+	}
+
+	// The original importer only reads ASCII
+	if (ascii)
+	{
+		results.push_back(run_benchmark("stl_import_legacy", input, format, bytes, options.iterations, [&]()
+		{
+			ifstream stl_stream(filename, ios::binary);
+			stl_import legacy_import(stl_stream);
+			return legacy_import.get_facets().size();
+		}));
+	}
+
+	triangle_mesh mesh;
+
+	results.push_back(run_benchmark("triangle_mesh_build", input, format, 0, options.iterations, [&]()
+	{
+		mesh.build(triangles);
+		return mesh.get_facets().size();
+	}));
+
+	results.push_back(run_benchmark("triangle_mesh_get_vbo_data", input, format, 0, options.iterations, [&]()
+	{
+		const triangle_mesh::vbo_data_t vbo_data = mesh.get_vbo_data();
+		return vbo_data.indices.size() / 3;
+	}));
+
+	// The same mesh written back out as ASCII
+	string ascii_stl;
+
+	benchmark_result write_result = run_benchmark("stl_exporter_ascii", input, "ascii", 0, options.iterations, [&]()
+	{
+		ostringstream ascii_stream;
+		stl_util::stl_exporter(ascii_stream, stl_util::stl_format::ascii).write(mesh);
+		ascii_stl = ascii_stream.str();
+		return mesh.get_facets().size();
+	});
+
+	write_result.bytes = ascii_stl.size();
+	results.push_back(write_result);
+}
+
+string json_escape(const string& s)
+{
+	string escaped;
+	for (char c : s)
+	{
+		switch (c)
+		{
+		case '"':	escaped += "\\\"";	break;
+		case '\\':	escaped += "\\\\";	break;
+		case '\n':	escaped += "\\n";	break;
+		case '\t':	escaped += "\\t";	break;
+		default:
+			if ((unsigned char) c < 0x20)
+			{
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", (unsigned) c);
+				escaped += code;
+			}
+			else
+			{
+				escaped += c;
+			}
+		}
+	}
+
+	return escaped;
+}
+
+void write_json(ostream& os, const benchmark_options& options, const vector<benchmark_result>& results)
+{
+	os << "{\n";
+	os << "  \"iterations\": " << options.iterations << ",\n";
+	os << "  \"synthetic_facets\": " << options.synthetic_facets << ",\n";
+	os << "  \"synthetic_shape\": \"" << stl_util::stl_generator::shape_name(options.synthetic_shape) << "\",\n";
+	os << "  \"results\": [\n";
+
+	for (size_t i = 0 ; i < results.size() ; i++)
+	{
+		const benchmark_result& r = results[i];
+		const double mb_per_s = r.best_seconds > 0.0 ? (double) r.bytes / (1024.0 * 1024.0) / r.best_seconds : 0.0;
+		const double facets_per_s = r.best_seconds > 0.0 ? (double) r.facets / r.best_seconds : 0.0;
+
+		os << "    {"
+		   << "\"name\": \"" << json_escape(r.name) << "\", "
+		   << "\"input\": \"" << json_escape(r.input) << "\", "
+		   << "\"format\": \"" << r.format << "\", "
+		   << "\"bytes\": " << r.bytes << ", "
+		   << "\"facets\": " << r.facets << ", "
+		   << "\"best_seconds\": " << r.best_seconds << ", "
+		   << "\"mean_seconds\": " << r.mean_seconds << ", "
+		   << "\"mb_per_s\": " << mb_per_s << ", "
+		   << "\"facets_per_s\": " << facets_per_s << ", "
+		   << "\"peak_rss_kb\": " << r.peak_rss_kb
+		   << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	os << "  ]\n";
+	os << "}\n";
+}
+
+void usage()
+{
+	cerr << "usage: stl_import_benchmark [--data-dir dir] [--facets n] [--shape shape] [--iterations n]"
+		 << " [--threads n] [--output file.json] [--help]" << endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	benchmark_options options;
+
+	for (int i = 1 ; i < argc ; i++)
+	{
+		const string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+		{
+			usage();
+			return 0;
+		}
+
+		// Everything else takes a value
+		if (i + 1 >= argc)
+		{
+			cerr << "Missing value for " << arg << endl;
+			usage();
+			return 1;
+		}
+
+		const string value = argv[++i];
+
+		try
+		{
+			if (arg == "--data-dir")
+				options.data_dir = value;
+			else if (arg == "--facets")
+				options.synthetic_facets = stoull(value);
+			else if (arg == "--shape")
+			{
+				if (!stl_util::stl_generator::parse_shape(value, options.synthetic_shape))
+				{
+					cerr << "Unknown shape " << value << endl;
+					usage();
+					return 1;
+				}
+			}
+			else if (arg == "--iterations")
+				options.iterations = std::max(1u, (unsigned) stoul(value));
+			else if (arg == "--threads")
+				options.num_threads = (unsigned) stoul(value);
+			else if (arg == "--output")
+				options.output = value;
+			else
+			{
+				cerr << "Unknown option " << arg << endl;
+				usage();
+				return 1;
+			}
+		}
+		catch (std::logic_error&)	// from stoul(), for something that isn't a number or is too big
+		{
+			cerr << "Bad value for " << arg << ": " << value << endl;
+			usage();
+			return 1;
+		}
+	}
+
+	vector<string> files;
+
+	if (filesystem::is_directory(options.data_dir))
+	{
+		for (const auto& entry : filesystem::directory_iterator(options.data_dir))
+		{
+			if (entry.is_regular_file() && entry.path().extension() == ".stl")
+				files.push_back(entry.path().string());
+		}
+	}
+	else
+	{
+		cerr << "No test data in " << options.data_dir << ", only running synthetic benchmarks" << endl;
+	}
+
+	sort(files.begin(), files.end());
+
+	// Large synthetic STLs, in both formats
+	vector<string> synthetic_files;
+	if (options.synthetic_facets > 0)
+	{
+		stl_util::stl_generator generator(options.synthetic_shape, options.synthetic_facets);
+		const filesystem::path temp_dir = filesystem::temp_directory_path();
+
+		for (auto format : { stl_util::stl_format::binary, stl_util::stl_format::ascii })
+		{
+			const string filename = (temp_dir / (string("stl_import_benchmark_") + generator.name() + "_" +
+				(format == stl_util::stl_format::binary ? "binary" : "ascii") + ".stl")).string();
+
+			ofstream stl_stream(filename, ios::binary);
+			stl_util::stl_exporter(stl_stream, format).write(generator);
+			stl_stream.close();
+
+			synthetic_files.push_back(filename);
+		}
+	}
+
+	files.insert(files.end(), synthetic_files.begin(), synthetic_files.end());
+
+	vector<benchmark_result> results;
+
+	try
+	{
+		for (const string& filename : files)
+			benchmark_file(filename, options, results);
+	}
+	catch (std::exception& e)
+	{
+		cerr << "Benchmark failed: " << e.what() << endl;
+
+		for (const string& filename : synthetic_files)
+			filesystem::remove(filename);
+
+		return 1;
+	}
+
+	for (const string& filename : synthetic_files)
+		filesystem::remove(filename);
+
+	if (options.output.empty())
+	{
+		write_json(cout, options, results);
+	}
+	else
+	{
+		ofstream json_stream(options.output);
+		write_json(json_stream, options, results);
+		json_stream.close();
+
+		if (json_stream.fail())
+		{
+			cerr << "Error writing " << options.output << endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * compact_mesh.cpp
+ */
+
+#include "compact_mesh.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+using std::vector;
+
+compact_mesh::compact_mesh(const vector<maths::triangle3d>& triangles)
+{
+	build(triangles);
+}
+
+void compact_mesh::reset()
+{
+	m_points.clear();
+	m_vertex_halfedge.clear();
+	m_halfedge_vertex.clear();
+	m_halfedge_sym.clear();
+	m_facet_normals.clear();
+
+	m_vertex_welder.clear();
+	m_welded_vertex_index.clear();
+	m_halfedge_index_map.clear();
+}
+
+void compact_mesh::set_weld_tolerance(double tolerance)
+{
+	m_vertex_welder = vertex_welder(tolerance);
+	m_welded_vertex_index.clear();
+}
+
+void compact_mesh::assign(vector<maths::vector3d> points, vector<index_t> vertex_halfedges, vector<index_t> indices,
+						  vector<index_t> sym_halfedges, vector<maths::vector3d> facet_normals)
+{
+	reset();
+
+	m_points = std::move(points);
+	m_vertex_halfedge = std::move(vertex_halfedges);
+	m_halfedge_vertex = std::move(indices);
+	m_halfedge_sym = std::move(sym_halfedges);
+	m_facet_normals = std::move(facet_normals);
+}
+
+void compact_mesh::reserve(size_t num_vertices, size_t num_facets)
+{
+	m_points.reserve(num_vertices);
+	m_vertex_halfedge.reserve(num_vertices);
+	m_halfedge_vertex.reserve(3 * num_facets);
+	m_halfedge_sym.reserve(3 * num_facets);
+	m_facet_normals.reserve(num_facets);
+}
+
+compact_mesh::index_t compact_mesh::add_vertex_(vertex_welder::index_t welded_vertex)
+{
+	index_t& v = m_welded_vertex_index[welded_vertex];
+	if (v == INVALID_INDEX)
+	{
+		v = (index_t) m_points.size();
+		m_points.push_back(m_vertex_welder.get_point(welded_vertex));
+		m_vertex_halfedge.push_back(INVALID_INDEX);
+	}
+
+	return v;
+}
+
+void compact_mesh::add_triangle(const maths::triangle3d& t)
+{
+	const index_t he0 = (index_t) m_halfedge_vertex.size();
+
+	vertex_welder::index_t welded_verts[3];
+	for (int i = 0 ; i < 3 ; i++)
+		welded_verts[i] = m_vertex_welder.weld(t[i]).first;
+
+	m_welded_vertex_index.resize(m_vertex_welder.size(), INVALID_INDEX);
+
+	if (m_vertex_welder.tolerance() > 0.0 &&
+		(welded_verts[0] == welded_verts[1] || welded_verts[1] == welded_verts[2] || welded_verts[2] == welded_verts[0]))
+	{
+		return;	// collapsed
+	}
+
+	index_t verts[3];
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		verts[i] = add_vertex_(welded_verts[i]);
+
+		m_halfedge_vertex.push_back(verts[i]);
+		m_halfedge_sym.push_back(INVALID_INDEX);
+
+		if (m_vertex_halfedge[verts[i]] == INVALID_INDEX)
+			m_vertex_halfedge[verts[i]] = he0 + i;
+	}
+
+	// Connect each halfedge to the first halfedge going the other way, if there is one
+	for (index_t i = 0 ; i < 3 ; i++)
+	{
+		const index_t e = he0 + i;
+		const index_t v_start = verts[i];
+		const index_t v_end = verts[(i + 1) % 3];
+
+		const index_t* sym = m_halfedge_index_map.find(std::make_pair(v_end, v_start));
+		if (sym)
+		{
+			m_halfedge_sym[e] = *sym;
+			m_halfedge_sym[*sym] = e;
+		}
+
+		m_halfedge_index_map.insert(std::make_pair(v_start, v_end), e);
+	}
+
+	// Our vertices might not be exactly at the corners of t if they were welded
+	m_facet_normals.push_back(get_triangle(get_facet(he0)).normal());
+}
+
+void compact_mesh::build(const vector<maths::triangle3d>& triangles)
+{
+	begin_build(triangles.size());
+	add_triangles(triangles.data(), triangles.size());
+	end_build();
+}
+
+void compact_mesh::begin_build(size_t expected_facets)
+{
+	reset();
+
+	// A closed mesh has about half as many vertices as facets
+	reserve(expected_facets / 2, expected_facets);
+
+	m_vertex_welder.reserve(expected_facets / 2);
+	m_halfedge_index_map.reserve(3 * expected_facets);
+}
+
+void compact_mesh::add_triangles(const maths::triangle3d* triangles, size_t num_triangles)
+{
+	for (size_t i = 0 ; i < num_triangles ; i++)
+		add_triangle(triangles[i]);
+}
+
+void compact_mesh::end_build()
+{
+	// don't need these no mo
+	m_vertex_welder.clear();
+	m_welded_vertex_index.clear();
+	m_halfedge_index_map.clear();
+}
+
+maths::triangle3d compact_mesh::get_triangle(index_t f) const
+{
+	const index_t he = get_facet_halfedge(f);
+	return maths::triangle3d(get_start_point(he), get_start_point(he + 1), get_start_point(he + 2));
+}
+
+vector<compact_mesh::index_t> compact_mesh::get_adjacent_facets(index_t f) const
+{
+	return compact_mesh_traversal::get_adjacent_facets(*this, f);
+}
+
+vector<compact_mesh::index_t> compact_mesh::get_adjacent_halfedges(index_t v) const
+{
+	return compact_mesh_traversal::get_adjacent_halfedges(*this, v);
+}
+
+vector<compact_mesh::index_t> compact_mesh::get_vertex_adjacent_facets(index_t v) const
+{
+	return compact_mesh_traversal::get_vertex_adjacent_facets(*this, v);
+}
+
+maths::vector3d compact_mesh::get_vertex_normal(index_t v) const
+{
+	return compact_mesh_traversal::get_vertex_normal(*this, v);
+}
+
+bool compact_mesh::is_manifold() const
+{
+	return std::find(m_halfedge_sym.begin(), m_halfedge_sym.end(), INVALID_INDEX) == m_halfedge_sym.end();
+}
+
+vector<compact_mesh::index_t> compact_mesh::get_lamina_halfedges() const
+{
+	vector<index_t> lamina_halfedges;
+	for (index_t he = 0 ; he < (index_t) num_halfedges() ; he++)
+	{
+		if (is_lamina(he))
+			lamina_halfedges.push_back(he);
+	}
+
+	return lamina_halfedges;
+}
+
+double compact_mesh::volume() const
+{
+	return get_surface_properties().volume();
+}
+
+double compact_mesh::area() const
+{
+	return get_surface_properties().area;
+}
+
+surface_properties compact_mesh::get_surface_properties() const
+{
+	return compute_surface_properties(m_points.data(), m_halfedge_vertex.data(), num_facets());
+}
+
+maths::bbox3d compact_mesh::bbox() const
+{
+	maths::bbox3d mesh_bbox;
+	mesh_bbox.add_points(m_points.begin(), m_points.end());
+
+	return mesh_bbox;
+}
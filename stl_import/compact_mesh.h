@@ -0,0 +1,274 @@
+/*
+ * compact_mesh.h
+ *
+ * A halfedge triangle mesh stored in flat arrays, with 32-bit indices
+ * in place of the shared_ptr / weak_ptr links used by triangle_mesh.
+ */
+
+#ifndef COMPACT_MESH_H_
+#define COMPACT_MESH_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "geom.h"
+#include "open_hash_map.h"
+#include "vertex_welder.h"
+#include "vbo_buffer.h"
+#include "surface_kernels.h"
+
+/** A triangle mesh with its topology stored in contiguous arrays.
+ *
+ *  Every vertex, halfedge and facet is identified by a 32-bit index.
+ *  The halfedges of facet f are 3f, 3f + 1 and 3f + 2, in CCW order, so the
+ *  next / previous halfedge and the facet of a halfedge are implicit.  The only
+ *  per-halfedge data is its start vertex (which doubles as the index buffer)
+ *  and its symmetric halfedge.
+ */
+class compact_mesh
+{
+public:
+	typedef std::uint32_t index_t;
+
+	static constexpr index_t INVALID_INDEX = ~index_t(0);
+
+private:
+	std::vector<maths::vector3d>	m_points;			// one per vertex
+	std::vector<index_t>			m_vertex_halfedge;	// one per vertex, any halfedge that starts at the vertex
+	std::vector<index_t>			m_halfedge_vertex;	// one per halfedge, the vertex that it starts at
+	std::vector<index_t>			m_halfedge_sym;		// one per halfedge, INVALID_INDEX for lamina halfedges
+	std::vector<maths::vector3d>	m_facet_normals;	// one per facet
+
+	std::string						m_name;
+
+	// Used when building the mesh from a set of triangles
+	typedef open_hash_map<std::pair<index_t, index_t>, index_t, pair_hash> halfedge_index_map_t;	// (start, end) vertex -> halfedge
+
+	vertex_welder			m_vertex_welder;
+	std::vector<index_t>	m_welded_vertex_index;	// welder vertex -> mesh vertex, INVALID_INDEX if no facet uses it yet
+	halfedge_index_map_t	m_halfedge_index_map;
+
+	index_t	add_vertex_(vertex_welder::index_t welded_vertex);
+
+public:
+	/** Create an empty mesh */
+	compact_mesh() { }
+
+	/** Create a mesh from a bunch of triangles */
+	compact_mesh(const std::vector<maths::triangle3d>& triangles);
+
+	/** Resets the mesh */
+	void reset();
+
+	/** Is the mesh empty? */
+	bool is_empty() const { return m_halfedge_vertex.empty(); }
+
+	/** Builds a new mesh from the given set of triangles */
+	void build(const std::vector<maths::triangle3d>& triangles);
+
+	/** @name Incremental build
+	 *  Builds a new mesh from triangles that arrive in batches, e.g. as they are
+	 *  read from an STL, so the triangles never all have to be in memory at once.
+	 *  expected_facets is only used to reserve space up front, and can be an estimate.
+	 *  @{ */
+	void begin_build(size_t expected_facets = 0);
+	void add_triangles(const maths::triangle3d* triangles, size_t num_triangles);
+	void end_build();	// frees the lookup tables used while building
+	/** @} */
+
+	/** Adds a facet for the given triangle, welding its vertices to existing vertices
+	 *  within the weld tolerance and connecting it to any matching existing halfedges.
+	 *  When welding with a tolerance, triangles that collapse are skipped. */
+	void add_triangle(const maths::triangle3d& t);
+
+	/** Sets the distance within which triangle corners are welded into the same vertex,
+	 *  for triangles added from here on.  With the default of 0, only identical points are welded.
+	 */
+	void set_weld_tolerance(double tolerance);
+	double weld_tolerance() const { return m_vertex_welder.tolerance(); }
+
+	/** Replaces the mesh with ready-made arrays (laid out as described by the raw array accessors),
+	 *  e.g. from a saved mesh.  Nothing is checked, so the arrays have to describe a valid mesh.
+	 */
+	void assign(std::vector<maths::vector3d> points, std::vector<index_t> vertex_halfedges, std::vector<index_t> indices,
+				std::vector<index_t> sym_halfedges, std::vector<maths::vector3d> facet_normals);
+
+	/** Reserves space for the given number of vertices and facets */
+	void reserve(size_t num_vertices, size_t num_facets);
+
+	size_t num_vertices() const { return m_points.size(); }
+	size_t num_halfedges() const { return m_halfedge_vertex.size(); }
+	size_t num_facets() const { return m_facet_normals.size(); }
+
+	/** @name Halfedge traversal
+	 *  @{ */
+	index_t get_next_halfedge(index_t he) const { return he - he % 3 + (he + 1) % 3; }
+	index_t get_prev_halfedge(index_t he) const { return he - he % 3 + (he + 2) % 3; }
+	index_t get_sym_halfedge(index_t he) const { return m_halfedge_sym[he]; }
+	index_t get_facet(index_t he) const { return he / 3; }
+	index_t get_vertex(index_t he) const { return m_halfedge_vertex[he]; }
+	index_t get_start_vertex(index_t he) const { return get_vertex(he); }
+	index_t get_end_vertex(index_t he) const { return get_vertex(get_next_halfedge(he)); }
+
+	const maths::vector3d& get_start_point(index_t he) const { return m_points[get_start_vertex(he)]; }
+	const maths::vector3d& get_end_point(index_t he) const { return m_points[get_end_vertex(he)]; }
+
+	bool is_lamina(index_t he) const { return m_halfedge_sym[he] == INVALID_INDEX; }
+	/** @} */
+
+	/** @name Facets
+	 *  @{ */
+	index_t get_facet_halfedge(index_t f) const { return 3 * f; }
+	const maths::vector3d& get_facet_normal(index_t f) const { return m_facet_normals[f]; }
+	maths::triangle3d get_triangle(index_t f) const;
+	std::vector<index_t> get_adjacent_facets(index_t f) const;
+	/** @} */
+
+	/** @name Vertices
+	 *  @{ */
+	index_t get_vertex_halfedge(index_t v) const { return m_vertex_halfedge[v]; }
+	const maths::vector3d& get_point(index_t v) const { return m_points[v]; }
+	void set_point(index_t v, const maths::vector3d& p) { m_points[v] = p; }
+
+	std::vector<index_t> get_adjacent_halfedges(index_t v) const;	// outgoing halfedges
+	std::vector<index_t> get_vertex_adjacent_facets(index_t v) const;
+	maths::vector3d get_vertex_normal(index_t v) const;
+	/** @} */
+
+	/** @name Raw arrays
+	 *  @{ */
+	const std::vector<maths::vector3d>& get_points() const { return m_points; }
+	const std::vector<index_t>& get_vertex_halfedges() const { return m_vertex_halfedge; }
+	const std::vector<index_t>& get_indices() const { return m_halfedge_vertex; }	// 3 vertex indices per facet
+	const std::vector<index_t>& get_sym_halfedges() const { return m_halfedge_sym; }
+	const std::vector<maths::vector3d>& get_facet_normals() const { return m_facet_normals; }
+	/** @} */
+
+	/** Returns the mesh as interleaved vertex positions and normals plus an index buffer,
+	 *  ready to upload to the GPU.  The indices are just get_indices().
+	 */
+	template <typename Real = float>
+	vbo_buffer<Real> get_vbo_buffer() const
+	{
+		vbo_buffer<Real> buffer;
+		buffer.indices = m_halfedge_vertex;
+		buffer.vertex_data.resize(m_points.size() * vbo_buffer<Real>::COMPONENTS_PER_VERTEX);
+
+		for (index_t v = 0 ; v < (index_t) m_points.size() ; v++)
+			buffer.set_vertex(v, m_points[v], get_vertex_normal(v));
+
+		return buffer;
+	}
+
+	/** Returns true if there are no lamina halfedges in the tessellation */
+	bool is_manifold() const;
+
+	std::vector<index_t> get_lamina_halfedges() const;
+
+	// Properties
+	double volume() const;	// unit-free
+	double area() const;
+	maths::bbox3d bbox() const;
+
+	/** Area, volume, centroid and bounding box at once, which is cheaper than asking for each */
+	surface_properties get_surface_properties() const;
+
+	std::string& name() { return m_name; }
+	const std::string& name() const { return m_name; }
+};
+
+/** Adjacency queries for anything laid out like a compact_mesh, with its halfedge traversal
+ *  functions: compact_mesh itself, and stl_util::mapped_compact_mesh, which answers them
+ *  straight out of a mapped file.
+ */
+namespace compact_mesh_traversal
+{
+
+typedef compact_mesh::index_t index_t;
+
+template <typename Mesh>
+std::vector<index_t> get_adjacent_facets(const Mesh& mesh, index_t f)
+{
+	std::vector<index_t> facets;
+
+	const index_t he = mesh.get_facet_halfedge(f);
+	for (index_t i = 0 ; i < 3 ; i++)
+	{
+		if (!mesh.is_lamina(he + i))
+			facets.push_back(mesh.get_facet(mesh.get_sym_halfedge(he + i)));
+	}
+
+	return facets;
+}
+
+/** The halfedges that start at vertex v */
+template <typename Mesh>
+std::vector<index_t> get_adjacent_halfedges(const Mesh& mesh, index_t v)
+{
+	std::vector<index_t> halfedges;
+
+	const index_t start_halfedge = mesh.get_vertex_halfedge(v);
+	if (start_halfedge == compact_mesh::INVALID_INDEX)
+		return halfedges;
+
+	index_t e = start_halfedge;
+	do
+	{
+		halfedges.push_back(e);
+		e = mesh.get_sym_halfedge(mesh.get_prev_halfedge(e));
+	}
+	while (e != compact_mesh::INVALID_INDEX && e != start_halfedge);
+
+	// On the boundary we run into a lamina halfedge before getting all the way around,
+	// so go back to the start and pick up the rest of the fan going the other way
+	if (e == compact_mesh::INVALID_INDEX)
+	{
+		for (index_t sym = mesh.get_sym_halfedge(start_halfedge) ; sym != compact_mesh::INVALID_INDEX ; sym = mesh.get_sym_halfedge(e))
+		{
+			e = mesh.get_next_halfedge(sym);
+			if (e == start_halfedge)
+				break;
+
+			halfedges.push_back(e);
+		}
+	}
+
+	return halfedges;
+}
+
+template <typename Mesh>
+std::vector<index_t> get_vertex_adjacent_facets(const Mesh& mesh, index_t v)
+{
+	std::vector<index_t> facets;
+
+	// A degenerate facet can have the same vertex more than once
+	for (index_t e : get_adjacent_halfedges(mesh, v))
+	{
+		if (std::find(facets.begin(), facets.end(), mesh.get_facet(e)) == facets.end())
+			facets.push_back(mesh.get_facet(e));
+	}
+
+	return facets;
+}
+
+template <typename Mesh>
+maths::vector3d get_vertex_normal(const Mesh& mesh, index_t v)
+{
+	maths::vector3d vert_normal;
+
+	const std::vector<index_t> adj_facets = get_vertex_adjacent_facets(mesh, v);
+	for (index_t f : adj_facets)
+		vert_normal += mesh.get_facet_normal(f);
+
+	vert_normal /= (double) adj_facets.size();
+	vert_normal.unit();
+
+	return vert_normal;
+}
+
+};
+
+#endif /* COMPACT_MESH_H_ */
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "compact_mesh_file.h"
+
+using namespace std;
+using namespace stl_util;
+
+namespace
+{
+
+typedef compact_mesh::index_t index_t;
+
+const char MAGIC[8] = { 'C', 'M', 'P', 'M', 'E', 'S', 'H', '\0' };
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+const size_t SECTION_ALIGNMENT = 8;
+
+struct file_header
+{
+	char			magic[8];
+	std::uint32_t	version;
+	std::uint32_t	byte_order;			// BYTE_ORDER_MARK, as the writer saw it
+	std::uint64_t	num_vertices;
+	std::uint64_t	num_facets;
+	std::uint64_t	points_offset;		// double[3 * num_vertices]
+	std::uint64_t	vertex_halfedges_offset;	// index_t[num_vertices]
+	std::uint64_t	indices_offset;		// index_t[3 * num_facets]
+	std::uint64_t	sym_halfedges_offset;	// index_t[3 * num_facets]
+	std::uint64_t	facet_normals_offset;	// double[3 * num_facets]
+	std::uint64_t	name_offset;		// char[name_size], not NUL terminated
+	std::uint64_t	name_size;
+	std::uint64_t	file_size;
+};
+
+static_assert(sizeof(file_header) % SECTION_ALIGNMENT == 0, "the first section has to be aligned");
+
+size_t align_section(size_t offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+// Lays out the sections for a mesh of the given size
+file_header make_header(size_t num_vertices, size_t num_facets, size_t name_size)
+{
+	file_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+
+	header.version = COMPACT_MESH_FILE_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.num_vertices = num_vertices;
+	header.num_facets = num_facets;
+
+	size_t offset = sizeof(file_header);
+
+	header.points_offset = offset;
+	offset = align_section(offset + 3 * num_vertices * sizeof(double));
+
+	header.vertex_halfedges_offset = offset;
+	offset = align_section(offset + num_vertices * sizeof(index_t));
+
+	header.indices_offset = offset;
+	offset = align_section(offset + 3 * num_facets * sizeof(index_t));
+
+	header.sym_halfedges_offset = offset;
+	offset = align_section(offset + 3 * num_facets * sizeof(index_t));
+
+	header.facet_normals_offset = offset;
+	offset = align_section(offset + 3 * num_facets * sizeof(double));
+
+	header.name_offset = offset;
+	header.name_size = name_size;
+	header.file_size = offset + name_size;
+
+	return header;
+}
+
+// Is the section of count elements of element_size bytes at offset aligned, and within size bytes?
+bool section_fits(std::uint64_t offset, std::uint64_t count, size_t element_size, size_t size)
+{
+	if (offset % SECTION_ALIGNMENT != 0 || offset > size)
+		return false;
+
+	return count <= (size - offset) / element_size;
+}
+
+// Writes the vectors' coordinates as doubles, which keeps the next section aligned.
+// They go through a small buffer, rather than a copy of the whole array.
+void write_vectors(ostream& ostream, const vector<maths::vector3d>& vectors)
+{
+	const size_t VECTORS_PER_WRITE = 1024;
+
+	double coords[3 * VECTORS_PER_WRITE];
+	for (size_t first = 0 ; first < vectors.size() ; first += VECTORS_PER_WRITE)
+	{
+		const size_t count = std::min(VECTORS_PER_WRITE, vectors.size() - first);
+		for (size_t i = 0 ; i < count ; i++)
+		{
+			coords[3 * i] = vectors[first + i][0];
+			coords[3 * i + 1] = vectors[first + i][1];
+			coords[3 * i + 2] = vectors[first + i][2];
+		}
+
+		ostream.write(reinterpret_cast<const char*>(coords), (streamsize) (3 * count * sizeof(double)));
+	}
+}
+
+void write_indices(ostream& ostream, const vector<index_t>& indices)
+{
+	ostream.write(reinterpret_cast<const char*>(indices.data()), (streamsize) (indices.size() * sizeof(index_t)));
+
+	// Doubles and indices are the only things that have to be aligned, so this is all the padding we need
+	if ((indices.size() * sizeof(index_t)) % SECTION_ALIGNMENT != 0)
+	{
+		const char padding[SECTION_ALIGNMENT] = { };
+		ostream.write(padding, (streamsize) (SECTION_ALIGNMENT - (indices.size() * sizeof(index_t)) % SECTION_ALIGNMENT));
+	}
+}
+
+vector<maths::vector3d> read_vectors(const double* coords, size_t count)
+{
+	vector<maths::vector3d> vectors;
+	vectors.reserve(count);
+
+	for (size_t i = 0 ; i < count ; i++)
+		vectors.push_back(maths::vector3d(coords[3 * i], coords[3 * i + 1], coords[3 * i + 2]));
+
+	return vectors;
+}
+
+};
+
+void stl_util::save_compact_mesh(const compact_mesh& mesh, ostream& ostream)
+{
+	if (mesh.num_vertices() >= compact_mesh::INVALID_INDEX || mesh.num_halfedges() >= compact_mesh::INVALID_INDEX)
+		throw std::runtime_error("Mesh is too big to save");
+
+	const file_header header = make_header(mesh.num_vertices(), mesh.num_facets(), mesh.name().size());
+	ostream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	write_vectors(ostream, mesh.get_points());
+	write_indices(ostream, mesh.get_vertex_halfedges());
+	write_indices(ostream, mesh.get_indices());
+	write_indices(ostream, mesh.get_sym_halfedges());
+	write_vectors(ostream, mesh.get_facet_normals());
+	ostream.write(mesh.name().data(), (streamsize) mesh.name().size());
+
+	if (!ostream.good())
+		throw std::runtime_error("Error writing compact mesh");
+}
+
+void stl_util::save_compact_mesh(const compact_mesh& mesh, const string& filename)
+{
+	ofstream mesh_file(filename, std::ios::binary | std::ios::trunc);
+	if (!mesh_file.is_open())
+		throw std::runtime_error("Error opening file");
+
+	save_compact_mesh(mesh, mesh_file);
+
+	mesh_file.close();
+	if (mesh_file.fail())
+		throw std::runtime_error("Error writing compact mesh");
+}
+
+void stl_util::load_compact_mesh(const string& filename, compact_mesh& mesh)
+{
+	mapped_compact_mesh(filename).get_mesh(mesh);
+}
+
+//////////////////////////
+// mapped_compact_mesh
+
+mapped_compact_mesh::mapped_compact_mesh(const string& filename)
+: m_file(filename)
+, m_num_vertices(0)
+, m_num_facets(0)
+, m_points(nullptr)
+, m_vertex_halfedges(nullptr)
+, m_indices(nullptr)
+, m_sym_halfedges(nullptr)
+, m_facet_normals(nullptr)
+{
+	const size_t size = m_file.size();
+
+	file_header header;
+	if (size < sizeof(header))
+		throw std::runtime_error("Not a compact mesh file");
+
+	std::memcpy(&header, m_file.data(), sizeof(header));
+
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+		throw std::runtime_error("Not a compact mesh file");
+
+	// The version doesn't mean anything if it's the wrong way around
+	if (header.byte_order != BYTE_ORDER_MARK)
+		throw std::runtime_error("Compact mesh file was written with a different byte order");
+
+	if (header.version != COMPACT_MESH_FILE_VERSION)
+		throw std::runtime_error("Unsupported compact mesh file version");
+
+	if (header.num_vertices >= compact_mesh::INVALID_INDEX || header.num_facets >= compact_mesh::INVALID_INDEX / 3)
+		throw std::runtime_error("Corrupt compact mesh file");
+
+	m_num_vertices = (size_t) header.num_vertices;
+	m_num_facets = (size_t) header.num_facets;
+
+	if (header.file_size != size ||
+		!section_fits(header.points_offset, 3 * header.num_vertices, sizeof(double), size) ||
+		!section_fits(header.vertex_halfedges_offset, header.num_vertices, sizeof(index_t), size) ||
+		!section_fits(header.indices_offset, 3 * header.num_facets, sizeof(index_t), size) ||
+		!section_fits(header.sym_halfedges_offset, 3 * header.num_facets, sizeof(index_t), size) ||
+		!section_fits(header.facet_normals_offset, 3 * header.num_facets, sizeof(double), size) ||
+		header.name_offset > size || header.name_size > size - header.name_offset)
+	{
+		throw std::runtime_error("Corrupt compact mesh file");
+	}
+
+	// The mapping is page aligned, and so are the sections within it
+	const char* data = m_file.data();
+	m_points = reinterpret_cast<const double*>(data + header.points_offset);
+	m_vertex_halfedges = reinterpret_cast<const index_t*>(data + header.vertex_halfedges_offset);
+	m_indices = reinterpret_cast<const index_t*>(data + header.indices_offset);
+	m_sym_halfedges = reinterpret_cast<const index_t*>(data + header.sym_halfedges_offset);
+	m_facet_normals = reinterpret_cast<const double*>(data + header.facet_normals_offset);
+	m_name = std::string_view(data + header.name_offset, (size_t) header.name_size);
+
+	check_indices_();
+}
+
+void mapped_compact_mesh::check_indices_() const
+{
+	const size_t num_halfedges = 3 * m_num_facets;
+
+	for (size_t v = 0 ; v < m_num_vertices ; v++)
+	{
+		if (m_vertex_halfedges[v] >= num_halfedges && m_vertex_halfedges[v] != compact_mesh::INVALID_INDEX)
+			throw std::runtime_error("Corrupt compact mesh file");
+	}
+
+	for (size_t he = 0 ; he < num_halfedges ; he++)
+	{
+		if (m_indices[he] >= m_num_vertices ||
+			(m_sym_halfedges[he] >= num_halfedges && m_sym_halfedges[he] != compact_mesh::INVALID_INDEX))
+		{
+			throw std::runtime_error("Corrupt compact mesh file");
+		}
+	}
+}
+
+maths::triangle3d mapped_compact_mesh::get_triangle(index_t f) const
+{
+	const index_t he = get_facet_halfedge(f);
+	return maths::triangle3d(get_point(get_start_vertex(he)), get_point(get_start_vertex(he + 1)), get_point(get_start_vertex(he + 2)));
+}
+
+void mapped_compact_mesh::get_mesh(compact_mesh& mesh) const
+{
+	mesh.assign(read_vectors(m_points, m_num_vertices),
+				vector<index_t>(m_vertex_halfedges, m_vertex_halfedges + m_num_vertices),
+				vector<index_t>(m_indices, m_indices + num_halfedges()),
+				vector<index_t>(m_sym_halfedges, m_sym_halfedges + num_halfedges()),
+				read_vectors(m_facet_normals, m_num_facets));
+
+	mesh.name() = string(m_name);
+}
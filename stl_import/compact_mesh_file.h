@@ -0,0 +1,123 @@
+#ifndef COMPACT_MESH_FILE_H_
+#define COMPACT_MESH_FILE_H_
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "compact_mesh.h"
+#include "mapped_file.h"
+
+namespace stl_util
+{
+
+/** @name Native compact_mesh files
+ *  A saved compact_mesh, so that a part can be reopened without parsing its STL
+ *  and welding its vertices all over again.
+ *
+ *  The file is a fixed-size header followed by the mesh's raw arrays, each starting
+ *  on an 8 byte boundary, in the byte order of the machine that wrote it:
+ *  the points (3 doubles per vertex), the vertex halfedges, the index buffer and
+ *  the symmetric halfedge table (32-bit indices), the facet normals (3 doubles
+ *  per facet) and the mesh name.  The header holds the format version and where
+ *  each array is, so a memory mapping of the file can be used as is.
+ *  @{ */
+
+/** The version written by save_compact_mesh(), and the only one that can be read */
+static constexpr std::uint32_t COMPACT_MESH_FILE_VERSION = 1;
+
+/** Throws std::runtime_error if writing fails */
+void save_compact_mesh(const compact_mesh& mesh, std::ostream& ostream);
+void save_compact_mesh(const compact_mesh& mesh, const std::string& filename);
+
+/** Reads a saved mesh into mesh, which is replaced.  Throws std::runtime_error if the
+ *  file can't be read or isn't a valid compact mesh file for this machine.
+ */
+void load_compact_mesh(const std::string& filename, compact_mesh& mesh);
+
+/** A saved compact_mesh, used straight out of a read-only memory mapping of the file.
+ *  The arrays are as described for compact_mesh's raw array accessors, and are only
+ *  valid for the lifetime of the mapped_compact_mesh.  The same traversal and adjacency
+ *  queries as compact_mesh work on the mapping, without copying anything.
+ *
+ *  Opening the file checks every index once (see check_indices_()), so that a corrupt
+ *  file can't make any of the queries read outside the mapping.
+ */
+class mapped_compact_mesh
+{
+public:
+	typedef compact_mesh::index_t index_t;
+
+private:
+	mapped_file		m_file;
+
+	size_t			m_num_vertices;
+	size_t			m_num_facets;
+
+	const double*	m_points;
+	const index_t*	m_vertex_halfedges;
+	const index_t*	m_indices;
+	const index_t*	m_sym_halfedges;
+	const double*	m_facet_normals;
+	std::string_view	m_name;
+
+	void check_indices_() const;	// so that a corrupt file can't send anyone off the end of an array
+
+public:
+	/** Maps the file and checks that it's valid, throwing std::runtime_error if it isn't */
+	explicit mapped_compact_mesh(const std::string& filename);
+
+	size_t num_vertices() const { return m_num_vertices; }
+	size_t num_halfedges() const { return 3 * m_num_facets; }
+	size_t num_facets() const { return m_num_facets; }
+
+	/** @name Raw arrays
+	 *  @{ */
+	const double* points() const { return m_points; }					// x, y, z per vertex
+	const index_t* vertex_halfedges() const { return m_vertex_halfedges; }
+	const index_t* indices() const { return m_indices; }				// 3 vertex indices per facet
+	const index_t* sym_halfedges() const { return m_sym_halfedges; }
+	const double* facet_normals() const { return m_facet_normals; }		// x, y, z per facet
+	/** @} */
+
+	/** @name Halfedge traversal
+	 *  As for compact_mesh.
+	 *  @{ */
+	index_t get_next_halfedge(index_t he) const { return he - he % 3 + (he + 1) % 3; }
+	index_t get_prev_halfedge(index_t he) const { return he - he % 3 + (he + 2) % 3; }
+	index_t get_sym_halfedge(index_t he) const { return m_sym_halfedges[he]; }
+	index_t get_facet(index_t he) const { return he / 3; }
+	index_t get_start_vertex(index_t he) const { return m_indices[he]; }
+	index_t get_end_vertex(index_t he) const { return m_indices[get_next_halfedge(he)]; }
+	bool is_lamina(index_t he) const { return m_sym_halfedges[he] == compact_mesh::INVALID_INDEX; }
+	/** @} */
+
+	/** @name Facets
+	 *  @{ */
+	index_t get_facet_halfedge(index_t f) const { return 3 * f; }
+	maths::vector3d get_facet_normal(index_t f) const { return maths::vector3d(m_facet_normals[3 * f], m_facet_normals[3 * f + 1], m_facet_normals[3 * f + 2]); }
+	maths::triangle3d get_triangle(index_t f) const;
+	std::vector<index_t> get_adjacent_facets(index_t f) const { return compact_mesh_traversal::get_adjacent_facets(*this, f); }
+	/** @} */
+
+	/** @name Vertices
+	 *  @{ */
+	index_t get_vertex_halfedge(index_t v) const { return m_vertex_halfedges[v]; }
+	maths::vector3d get_point(index_t v) const { return maths::vector3d(m_points[3 * v], m_points[3 * v + 1], m_points[3 * v + 2]); }
+
+	std::vector<index_t> get_adjacent_halfedges(index_t v) const { return compact_mesh_traversal::get_adjacent_halfedges(*this, v); }	// outgoing halfedges
+	std::vector<index_t> get_vertex_adjacent_facets(index_t v) const { return compact_mesh_traversal::get_vertex_adjacent_facets(*this, v); }
+	maths::vector3d get_vertex_normal(index_t v) const { return compact_mesh_traversal::get_vertex_normal(*this, v); }
+	/** @} */
+
+	std::string_view name() const { return m_name; }
+
+	/** Copies the arrays into mesh, which is replaced, for when the mesh is going to be changed */
+	void get_mesh(compact_mesh& mesh) const;
+};
+
+/** @} */
+
+};
+
+#endif // COMPACT_MESH_FILE_H_
@@ -0,0 +1,114 @@
+#ifndef INSTRUMENTATION_H_
+#define INSTRUMENTATION_H_
+
+#include <chrono>
+#include <cstddef>
+
+/** Optional counters and phase timers for stl_importer and triangle_mesh::build().
+ *
+ *  Build with STL_IMPORT_INSTRUMENTATION defined (the ENABLE_INSTRUMENTATION CMake
+ *  option) to fill in the stats.  Otherwise STL_IMPORT_STAT() and STL_IMPORT_TIMER()
+ *  compile to nothing, so there is no cost on the hot paths, and the stats stay zero.
+ */
+
+#ifdef STL_IMPORT_INSTRUMENTATION
+#define STL_IMPORT_CONCAT_(a, b) a##b
+#define STL_IMPORT_TIMER_NAME_(line) STL_IMPORT_CONCAT_(stl_import_timer_, line)
+
+/** Runs statement only in instrumented builds */
+#define STL_IMPORT_STAT(statement) statement
+
+/** Adds the time until the end of the enclosing scope to seconds, in instrumented builds */
+#define STL_IMPORT_TIMER(seconds) stl_util::scoped_timer STL_IMPORT_TIMER_NAME_(__LINE__)(seconds)
+#else
+#define STL_IMPORT_STAT(statement) do { } while (false)
+#define STL_IMPORT_TIMER(seconds) do { } while (false)
+#endif
+
+namespace stl_util
+{
+
+#ifdef STL_IMPORT_INSTRUMENTATION
+static constexpr bool instrumentation_enabled = true;
+#else
+static constexpr bool instrumentation_enabled = false;
+#endif
+
+/** What stl_importer spent its time on.  The counts and times add up over all of
+ *  the importer's imports, until stl_importer::reset_stats().
+ */
+struct import_stats
+{
+	double	detect_seconds = 0.0;	/**< working out whether the STL is ASCII or binary */
+	double	count_seconds = 0.0;	/**< counting (or estimating) the facets before importing */
+	double	parse_seconds = 0.0;	/**< reading and decoding facets */
+	double	output_seconds = 0.0;	/**< handing facets to the output iterator or batch handler */
+	double	total_seconds = 0.0;	/**< in import(), import_batches() and import_soup(), which includes the parsing and output */
+
+	size_t	bytes_read = 0;
+	size_t	facets_parsed = 0;
+	size_t	buffer_allocations = 0;	/**< read buffers and facet batches that were (re)allocated */
+	size_t	lines_skipped = 0;		/**< blank lines, and the lines of ASCII facets that couldn't be parsed */
+};
+
+/** What triangle_mesh::build() spent its time on, for the last build.
+ *  Only the multithreaded build is broken down into phases, the single
+ *  threaded build welds and connects one triangle at a time.
+ */
+struct mesh_build_stats
+{
+	double	weld_seconds = 0.0;		/**< matching triangle corners up into vertices */
+	double	create_seconds = 0.0;	/**< creating the vertices, halfedges and facets */
+	double	connect_seconds = 0.0;	/**< pairing up symmetric halfedges */
+	double	total_seconds = 0.0;
+
+	size_t	facets = 0;
+	size_t	vertices = 0;
+	size_t	allocations = 0;		/**< mesh elements (vertices, halfedges, edges and facets) allocated */
+};
+
+/** Adds the time between its construction and destruction to a running total */
+class scoped_timer
+{
+private:
+	double&									m_seconds;
+	std::chrono::steady_clock::time_point	m_start;
+
+public:
+	explicit scoped_timer(double& seconds)
+	: m_seconds(seconds)
+	, m_start(std::chrono::steady_clock::now())
+	{
+
+	}
+
+	~scoped_timer()
+	{
+		m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	scoped_timer(const scoped_timer&) = delete;
+	scoped_timer& operator=(const scoped_timer&) = delete;
+};
+
+/** Times consecutive phases of a function, for when they don't each have their own scope */
+class phase_timer
+{
+private:
+	std::chrono::steady_clock::time_point	m_start;
+
+public:
+	phase_timer() : m_start(std::chrono::steady_clock::now()) { }
+
+	/** Adds the time since the last lap (or construction) to seconds, and starts the next phase */
+	void lap(double& seconds)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		seconds += std::chrono::duration<double>(now - m_start).count();
+		m_start = now;
+	}
+};
+
+};
+
+#endif // INSTRUMENTATION_H_
@@ -0,0 +1,54 @@
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+
+using namespace std;
+using namespace stl_util;
+
+mapped_file::mapped_file(const string& filename)
+: m_data(nullptr)
+, m_size(0)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Error opening file");
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		::close(fd);
+		throw std::runtime_error("Error mapping file");
+	}
+
+	m_size = (size_t) st.st_size;
+
+	// mmap() doesn't like zero-length mappings, so an empty file just has no data
+	if (m_size > 0)
+	{
+		void* addr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED)
+		{
+			::close(fd);
+			throw std::runtime_error("Error mapping file");
+		}
+
+		// We're going to read the whole thing front to back
+		::madvise(addr, m_size, MADV_SEQUENTIAL);
+
+		m_data = static_cast<const char*>(addr);
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	::close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+	if (m_data)
+		::munmap(const_cast<char*>(m_data), m_size);
+}
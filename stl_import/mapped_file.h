@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <string>
+#include <cstddef>
+
+namespace stl_util
+{
+
+/** A read-only memory mapping of an entire file.
+ *  The mapping is released when the object is destroyed, so any pointers
+ *  obtained from data() must not outlive it.
+ */
+class mapped_file
+{
+private:
+	const char*	m_data;
+	size_t		m_size;
+
+public:
+	mapped_file(const std::string& filename);	// throws if the file can't be opened or mapped
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+};
+
+};
+
+#endif // MAPPED_FILE_H_
@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "mesh_cache.h"
+#include "mesh_import.h"
+#include "compact_mesh_file.h"
+#include "mapped_file.h"
+
+using namespace std;
+using namespace stl_util;
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+const char MESH_EXTENSION[] = ".cmesh";
+const char KEY_EXTENSION[] = ".key";
+const char TEMP_EXTENSION[] = ".tmp";
+
+// Temporary files this old belong to a process that died before renaming them
+const std::chrono::hours STALE_TEMP_AGE(1);
+
+/** Holds a flock() on the cache directory's lock file for its lifetime.
+ *  If the lock file can't be opened we carry on without it; every file is
+ *  renamed into place whole, so the worst that can happen is a lookup missing
+ *  an entry that's being trimmed.
+ */
+class directory_lock
+{
+private:
+	int	m_fd;
+
+public:
+	directory_lock(const string& directory, int operation)
+	: m_fd(::open((directory + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666))
+	{
+		if (m_fd >= 0)
+		{
+			while (::flock(m_fd, operation) != 0 && errno == EINTR)
+				;
+		}
+	}
+
+	~directory_lock()
+	{
+		if (m_fd >= 0)
+			::close(m_fd);	// releases the lock
+	}
+
+	directory_lock(const directory_lock&) = delete;
+	directory_lock& operator=(const directory_lock&) = delete;
+};
+
+string to_hex(std::uint64_t n)
+{
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) n);
+	return hex;
+}
+
+bool has_extension(const fs::path& path, const char* extension)
+{
+	return path.extension() == extension;
+}
+
+// A file name in the same directory as path that nobody else will pick
+string temp_path(const string& path)
+{
+	static std::atomic<unsigned> s_counter(0);
+
+	return path + "." + to_string(::getpid()) + "." + to_string(s_counter++) + TEMP_EXTENSION;
+}
+
+// Marks a cache file as just used
+void touch(const string& path)
+{
+	::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+}
+
+// Is the file at path still the one that was stat()ed as st?
+bool unchanged(const string& path, const struct stat& st)
+{
+	struct stat now;
+	if (::stat(path.c_str(), &now) != 0)
+		return false;
+
+	return now.st_dev == st.st_dev && now.st_ino == st.st_ino && now.st_size == st.st_size &&
+		now.st_mtim.tv_sec == st.st_mtim.tv_sec && now.st_mtim.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+std::uint64_t rotl(std::uint64_t x, int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+std::uint64_t read_word(const char* data)
+{
+	std::uint64_t word;
+	std::memcpy(&word, data, sizeof(word));
+	return word;
+}
+
+};
+
+mesh_cache::mesh_cache(const string& directory, std::uint64_t max_size)
+: m_directory(directory)
+, m_max_size(max_size)
+{
+	std::error_code error;
+	fs::create_directories(m_directory, error);
+
+	if (!fs::is_directory(m_directory))
+		throw std::runtime_error("Error creating mesh cache directory");
+}
+
+//static
+std::uint64_t mesh_cache::hash_bytes(const char* data, size_t size)
+{
+	// Along the lines of xxHash64: four independent lanes of multiply-rotate over
+	// 8 byte words, so that the multiplies overlap, then the tail a byte at a time
+	const std::uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+	const std::uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+	const std::uint64_t PRIME3 = 0x165667b19e3779f9ull;
+
+	std::uint64_t lanes[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+
+	size_t i = 0;
+	for ( ; i + 32 <= size ; i += 32)
+	{
+		for (size_t l = 0 ; l < 4 ; l++)
+			lanes[l] = rotl(lanes[l] + read_word(data + i + 8 * l) * PRIME2, 31) * PRIME1;
+	}
+
+	std::uint64_t hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+	hash += (std::uint64_t) size * PRIME3;
+
+	for ( ; i + 8 <= size ; i += 8)
+		hash = rotl(hash ^ (rotl(read_word(data + i) * PRIME2, 31) * PRIME1), 27) * PRIME1 + PRIME3;
+
+	for ( ; i < size ; i++)
+		hash = rotl(hash ^ ((std::uint64_t) (unsigned char) data[i] * PRIME3), 11) * PRIME1;
+
+	// Mix the last few bytes into all of the bits
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+string mesh_cache::key_path_(const string& stl_filename) const
+{
+	return m_directory + "/" + to_hex(hash_bytes(stl_filename.data(), stl_filename.size())) + KEY_EXTENSION;
+}
+
+string mesh_cache::mesh_path_(std::uint64_t content_hash, std::uint64_t content_size, double weld_tolerance) const
+{
+	std::uint64_t tolerance_bits;
+	std::memcpy(&tolerance_bits, &weld_tolerance, sizeof(tolerance_bits));
+
+	// The size is in the name too, so that two STLs would have to collide on both to share a mesh
+	return m_directory + "/" + to_hex(content_hash) + "-" + to_hex(content_size) + "-" + to_hex(tolerance_bits) + MESH_EXTENSION;
+}
+
+bool mesh_cache::load_mesh_(const string& mesh_path, compact_mesh& mesh) const
+{
+	try
+	{
+		mapped_compact_mesh(mesh_path).get_mesh(mesh);
+	}
+	catch (std::runtime_error&)
+	{
+		// Missing, or no good (e.g. written by another version), so it'll be replaced
+		std::error_code error;
+		fs::remove(mesh_path, error);
+
+		return false;
+	}
+
+	touch(mesh_path);
+
+	return true;
+}
+
+bool mesh_cache::get_mesh(const string& stl_filename, compact_mesh& mesh)
+{
+	struct stat st;
+	std::error_code error;
+	const string stl_path = fs::absolute(stl_filename, error).lexically_normal().string();
+
+	// Only regular files can be fingerprinted (and read more than once)
+	if (error || ::stat(stl_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		stl_importer importer(stl_filename);
+		import_compact_mesh(importer, mesh);
+		return false;
+	}
+
+	// The key file for the STL's path says what was in it when it had this size and mtime
+	const string key_path = key_path_(stl_path);
+
+	ostringstream key_stream;
+	key_stream << stl_path << '\n' << st.st_size << ' ' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << '\n';
+	const string key = key_stream.str();
+
+	{
+		directory_lock lock(m_directory, LOCK_SH);
+
+		ifstream key_file(key_path, std::ios::binary);
+		string key_contents((istreambuf_iterator<char>(key_file)), istreambuf_iterator<char>());
+
+		if (key_contents.size() == key.size() + sizeof(std::uint64_t) && key_contents.compare(0, key.size(), key) == 0)
+		{
+			std::uint64_t content_hash;
+			std::memcpy(&content_hash, key_contents.data() + key.size(), sizeof(content_hash));
+
+			if (load_mesh_(mesh_path_(content_hash, (std::uint64_t) st.st_size, mesh.weld_tolerance()), mesh))
+			{
+				touch(key_path);
+				return true;
+			}
+		}
+	}
+
+	// Otherwise we need the contents.  The same STL may have been cached under another name.
+	std::uint64_t content_hash;
+	std::uint64_t content_size;
+	try
+	{
+		mapped_file stl_file(stl_path);
+		content_hash = hash_bytes(stl_file.data(), stl_file.size());
+		content_size = stl_file.size();
+	}
+	catch (std::runtime_error&)
+	{
+		stl_importer importer(stl_filename);
+		import_compact_mesh(importer, mesh);
+		return false;
+	}
+
+	const string mesh_path = mesh_path_(content_hash, content_size, mesh.weld_tolerance());
+	string key_contents = key;
+	key_contents.append(reinterpret_cast<const char*>(&content_hash), sizeof(content_hash));
+
+	bool cached;
+	{
+		directory_lock lock(m_directory, LOCK_SH);
+		cached = load_mesh_(mesh_path, mesh);
+	}
+
+	if (!cached)
+	{
+		stl_importer importer(stl_filename);
+		import_compact_mesh(importer, mesh);
+	}
+
+	// The STL was read again to hash and import it, and if it changed since it was stat()ed
+	// the mesh, the hash and the key might all be for different contents
+	if (!unchanged(stl_path, st))
+		return cached;
+
+	// Failing to cache the mesh doesn't make it any less of a mesh
+	try
+	{
+		store_mesh_(key_path, key_contents, cached ? string() : mesh_path, mesh);
+	}
+	catch (std::exception&)
+	{
+	}
+
+	return cached;
+}
+
+void mesh_cache::store_mesh_(const string& key_path, const string& key, const string& mesh_path, const compact_mesh& mesh)
+{
+	// Write everything to temporary files first, without holding anyone up...
+	const string key_temp_path = temp_path(key_path);
+	const string mesh_temp_path = mesh_path.empty() ? string() : temp_path(mesh_path);
+
+	try
+	{
+		if (!mesh_path.empty())
+			save_compact_mesh(mesh, mesh_temp_path);
+
+		ofstream key_file(key_temp_path, std::ios::binary | std::ios::trunc);
+		key_file.write(key.data(), (streamsize) key.size());
+		key_file.close();
+
+		if (key_file.fail())
+			throw std::runtime_error("Error writing mesh cache key");
+
+		// ...then rename them into place, which is atomic
+		directory_lock lock(m_directory, LOCK_EX);
+
+		if (!mesh_path.empty() && ::rename(mesh_temp_path.c_str(), mesh_path.c_str()) != 0)
+			throw std::runtime_error("Error adding mesh to cache");
+
+		if (::rename(key_temp_path.c_str(), key_path.c_str()) != 0)
+			throw std::runtime_error("Error adding mesh to cache");
+
+		trim_();
+	}
+	catch (std::exception&)
+	{
+		std::error_code error;
+		fs::remove(key_temp_path, error);
+		if (!mesh_temp_path.empty())
+			fs::remove(mesh_temp_path, error);
+
+		throw;
+	}
+}
+
+void mesh_cache::trim()
+{
+	directory_lock lock(m_directory, LOCK_EX);
+	trim_();
+}
+
+void mesh_cache::trim_()
+{
+	struct cache_file
+	{
+		fs::file_time_type	last_used;
+		std::uint64_t		size;
+		fs::path			path;
+	};
+
+	vector<cache_file> files;
+	std::uint64_t total_size = 0;
+
+	std::error_code error;
+	const fs::file_time_type stale_time = fs::file_time_type::clock::now() - STALE_TEMP_AGE;
+
+	for (const fs::directory_entry& entry : fs::directory_iterator(m_directory, error))
+	{
+		const fs::path& path = entry.path();
+
+		if (!entry.is_regular_file(error))
+			continue;
+
+		cache_file file;
+		file.path = path;
+		file.last_used = entry.last_write_time(error);
+		if (error)
+			continue;
+
+		file.size = entry.file_size(error);
+		if (error)
+			continue;
+
+		if (has_extension(path, TEMP_EXTENSION))
+		{
+			if (file.last_used < stale_time)
+				fs::remove(path, error);
+		}
+		else if (has_extension(path, MESH_EXTENSION) || has_extension(path, KEY_EXTENSION))
+		{
+			files.push_back(file);
+			total_size += file.size;
+		}
+	}
+
+	// Least recently used first
+	std::sort(files.begin(), files.end(), [](const cache_file& a, const cache_file& b) { return a.last_used < b.last_used; });
+
+	for (size_t i = 0 ; i < files.size() && total_size > m_max_size ; i++)
+	{
+		if (fs::remove(files[i].path, error))
+			total_size -= files[i].size;
+	}
+}
+
+std::uint64_t mesh_cache::size() const
+{
+	std::uint64_t total_size = 0;
+
+	std::error_code error;
+	for (const fs::directory_entry& entry : fs::directory_iterator(m_directory, error))
+	{
+		if (has_extension(entry.path(), MESH_EXTENSION) || has_extension(entry.path(), KEY_EXTENSION))
+		{
+			const std::uintmax_t size = entry.file_size(error);
+			if (!error)
+				total_size += size;
+		}
+	}
+
+	return total_size;
+}
+
+void mesh_cache::clear()
+{
+	directory_lock lock(m_directory, LOCK_EX);
+
+	std::error_code error;
+	for (const fs::directory_entry& entry : fs::directory_iterator(m_directory, error))
+	{
+		if (has_extension(entry.path(), MESH_EXTENSION) || has_extension(entry.path(), KEY_EXTENSION))
+			fs::remove(entry.path(), error);
+	}
+}
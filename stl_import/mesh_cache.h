@@ -0,0 +1,77 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "compact_mesh.h"
+
+namespace stl_util
+{
+
+/** An on-disk cache of meshes built from STL files, for when the same STLs are
+ *  opened over and over.
+ *
+ *  Meshes are saved in the native compact_mesh format (see compact_mesh_file.h),
+ *  named after a hash of the STL's contents, its size and the weld tolerance, so identical
+ *  STLs share an entry wherever they live.  A small key file per STL path remembers
+ *  the content hash for the STL's full path, size and modification time, so unchanged
+ *  files are found without reading them at all, and an STL that has been touched since
+ *  is read and hashed again.
+ *
+ *  Least recently used entries are removed once the cache grows past its size limit.
+ *  Several processes can share a cache directory: entries are written to a temporary
+ *  file and renamed into place, and lookups and trimming are serialized with flock().
+ *  Anything wrong with the cache (a corrupt entry, a full disk) just means the STL
+ *  gets imported as if there was no cache.
+ */
+class mesh_cache
+{
+private:
+	std::string		m_directory;
+	std::uint64_t	m_max_size;
+
+	static const std::uint64_t	DEFAULT_MAX_SIZE = std::uint64_t(1) << 30;
+
+	std::string key_path_(const std::string& stl_filename) const;
+	std::string mesh_path_(std::uint64_t content_hash, std::uint64_t content_size, double weld_tolerance) const;
+	bool load_mesh_(const std::string& mesh_path, compact_mesh& mesh) const;
+	void store_mesh_(const std::string& key_path, const std::string& key, const std::string& mesh_path, const compact_mesh& mesh);
+	void trim_();	// with the cache locked
+
+public:
+	/** Uses the given cache directory, creating it if need be.
+	 *  Throws std::runtime_error if the directory can't be created.
+	 */
+	explicit mesh_cache(const std::string& directory, std::uint64_t max_size = DEFAULT_MAX_SIZE);
+
+	const std::string& directory() const { return m_directory; }
+
+	/** The size in bytes that the cache is trimmed to after each new entry */
+	void set_max_size(std::uint64_t max_size) { m_max_size = max_size; }
+	std::uint64_t max_size() const { return m_max_size; }
+
+	/** Gets the mesh for an STL, welded with the mesh's weld tolerance.  The mesh comes from
+	 *  the cache if the same STL has been imported before, otherwise the STL is imported
+	 *  (see import_compact_mesh()) and the mesh is added to the cache.
+	 *  Throws whatever stl_importer throws if the STL can't be imported.
+	 *  @return true if the mesh came from the cache
+	 */
+	bool get_mesh(const std::string& stl_filename, compact_mesh& mesh);
+
+	/** The total size in bytes of the cached meshes and keys */
+	std::uint64_t size() const;
+
+	/** Removes least recently used entries until the cache fits in max_size() */
+	void trim();
+
+	/** Removes every entry */
+	void clear();
+
+	/** The content hash that entries are named after, a fast 64-bit non-cryptographic hash */
+	static std::uint64_t hash_bytes(const char* data, size_t size);
+};
+
+};
+
+#endif // MESH_CACHE_H_
@@ -0,0 +1,16 @@
+#include "mesh_import.h"
+
+using namespace stl_util;
+
+void stl_util::import_compact_mesh(stl_importer& importer, compact_mesh& mesh)
+{
+	mesh.begin_build(importer.num_facets_to_reserve());
+
+	importer.import_batches([&](const maths::triangle3d* triangles, size_t num_triangles)
+	{
+		mesh.add_triangles(triangles, num_triangles);
+	});
+
+	mesh.end_build();
+	mesh.name() = importer.name();
+}
@@ -0,0 +1,20 @@
+#ifndef MESH_IMPORT_H_
+#define MESH_IMPORT_H_
+
+#include "stl_importer.h"
+#include "compact_mesh.h"
+
+namespace stl_util
+{
+
+/** Imports an STL straight into a compact_mesh, one batch of facets at a time.
+ *  Unlike importing into a vector of triangles and building the mesh from that,
+ *  the STL's triangles are never all in memory alongside the mesh, so peak memory
+ *  is about the size of the mesh and its build-time lookup tables.
+ *  Any weld tolerance that was set on the mesh is used.
+ */
+void import_compact_mesh(stl_importer& importer, compact_mesh& mesh);
+
+};
+
+#endif // MESH_IMPORT_H_
@@ -0,0 +1,174 @@
+/*
+ * open_hash_map.h
+ *
+ * A small open-addressing hash map, used for welding vertices and
+ * matching up symmetric halfedges when building meshes.
+ */
+
+#ifndef OPEN_HASH_MAP_H_
+#define OPEN_HASH_MAP_H_
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include "geom.h"
+
+/** An open-addressing hash map with linear probing.
+ *  Keys and values are stored inline in a single array, so lookups don't chase
+ *  any pointers.  Elements can be inserted and looked up, but not erased.
+ *  Key and Value must be default-constructible.
+ */
+template <typename Key, typename Value, typename Hash, typename KeyEqual = std::equal_to<Key>>
+class open_hash_map
+{
+private:
+	struct slot
+	{
+		Key		key;
+		Value	value;
+		bool	used = false;
+	};
+
+	std::vector<slot>	m_slots;	// size is always 0 or a power of 2
+	size_t				m_size = 0;
+	Hash				m_hash;
+	KeyEqual			m_key_equal;
+
+	// Spread the bits of the hash around, so that we can just mask off the low bits
+	static size_t mix_(std::uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+
+		return (size_t) h;
+	}
+
+	size_t find_slot_(const Key& key) const
+	{
+		const size_t mask = m_slots.size() - 1;
+
+		size_t i = mix_(m_hash(key)) & mask;
+		while (m_slots[i].used && !m_key_equal(m_slots[i].key, key))
+			i = (i + 1) & mask;
+
+		return i;
+	}
+
+	void rehash_(size_t num_slots)
+	{
+		std::vector<slot> old_slots(num_slots);
+		old_slots.swap(m_slots);
+
+		for (auto& s : old_slots)
+		{
+			if (s.used)
+				m_slots[find_slot_(s.key)] = std::move(s);
+		}
+	}
+
+public:
+	/** Makes room for at least num_elements elements without rehashing */
+	void reserve(size_t num_elements)
+	{
+		size_t num_slots = 16;
+		while (num_slots < 2 * num_elements)	// keep the load factor under 1/2
+			num_slots *= 2;
+
+		if (num_slots > m_slots.size())
+			rehash_(num_slots);
+	}
+
+	void clear()
+	{
+		m_slots.clear();
+		m_slots.shrink_to_fit();
+		m_size = 0;
+	}
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	/** Returns a pointer to the value for key, or null if there isn't one */
+	Value* find(const Key& key)
+	{
+		if (m_slots.empty())
+			return nullptr;
+
+		slot& s = m_slots[find_slot_(key)];
+		return s.used ? &s.value : nullptr;
+	}
+
+	const Value* find(const Key& key) const
+	{
+		return const_cast<open_hash_map*>(this)->find(key);
+	}
+
+	/** Inserts value for key, unless there is already a value for key.
+	 *  @return the value for key, and whether it was inserted.
+	 */
+	std::pair<Value*, bool> insert(const Key& key, const Value& value)
+	{
+		if (2 * (m_size + 1) > m_slots.size())
+			reserve(m_size + 1);
+
+		slot& s = m_slots[find_slot_(key)];
+		if (s.used)
+			return std::make_pair(&s.value, false);
+
+		s.key = key;
+		s.value = value;
+		s.used = true;
+		m_size++;
+
+		return std::make_pair(&s.value, true);
+	}
+};
+
+/** Hashes a point by the bits of its coordinates.  Points that compare equal hash equally. */
+struct point_hash
+{
+	std::uint64_t operator()(const maths::vector3d& p) const
+	{
+		std::uint64_t h = 0;
+		for (size_t i = 0 ; i < 3 ; i++)
+		{
+			const double c = p[i] + 0.0;	// -0.0 == 0.0, so they need to hash the same
+
+			std::uint64_t bits;
+			std::memcpy(&bits, &c, sizeof(bits));
+
+			h = (h ^ bits) * 0x100000001b3ULL;
+			h ^= h >> 29;
+		}
+
+		return h;
+	}
+};
+
+/** Hashes a pair of integers or pointers, e.g. the start and end vertices of a halfedge */
+struct pair_hash
+{
+	template <typename T>
+	std::uint64_t operator()(const std::pair<T, T>& p) const
+	{
+		return (std::uint64_t) (std::uintptr_t) p.first * 0x9e3779b97f4a7c15ULL ^ (std::uint64_t) (std::uintptr_t) p.second;
+	}
+};
+
+/** Hashes a pointer, e.g. to give each mesh vertex an index */
+struct pointer_hash
+{
+	template <typename T>
+	std::uint64_t operator()(const T* p) const
+	{
+		return (std::uint64_t) (std::uintptr_t) p;
+	}
+};
+
+#endif /* OPEN_HASH_MAP_H_ */
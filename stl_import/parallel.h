@@ -0,0 +1,119 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+namespace stl_util
+{
+
+/** Resolves a requested thread count, where 0 means "one per hardware thread" */
+inline unsigned resolve_num_threads(unsigned num_threads)
+{
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	return num_threads;
+}
+
+/** Calls task(i) for each i in [0, num_tasks) on up to num_threads worker threads.
+ *  Workers pull task indices from a shared counter, so tasks of uneven size balance out.
+ *  If any task throws, the first exception is rethrown on the calling thread once
+ *  all of the workers have finished.
+ */
+template <typename Task>
+void parallel_for(size_t num_tasks, unsigned num_threads, Task task)
+{
+	num_threads = (unsigned) std::min<size_t>(resolve_num_threads(num_threads), num_tasks);
+
+	if (num_threads <= 1)
+	{
+		for (size_t i = 0 ; i < num_tasks ; i++)
+			task(i);
+
+		return;
+	}
+
+	std::atomic<size_t> next_task(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+
+	auto worker = [&]()
+	{
+		for (size_t i = next_task++ ; i < num_tasks && !failed ; i = next_task++)
+		{
+			try
+			{
+				task(i);
+			}
+			catch (...)
+			{
+				if (!failed.exchange(true))
+					error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+	for (unsigned i = 1 ; i < num_threads ; i++)
+		threads.emplace_back(worker);
+
+	worker();	// the calling thread does its share, too
+
+	for (auto& t : threads)
+		t.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+/** Sorts [first, last) on up to num_threads threads.
+ *  The range is split into one run per thread, the runs are sorted concurrently,
+ *  and then neighboring runs are merged pairwise until there is only one left.
+ */
+template <typename RandomIt, typename Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp, unsigned num_threads)
+{
+	const size_t MIN_RUN_SIZE = 1 << 14;	// not worth a thread below this
+
+	const size_t n = last - first;
+	const size_t num_runs = std::min<size_t>(resolve_num_threads(num_threads), n / MIN_RUN_SIZE);
+
+	if (num_runs <= 1)
+	{
+		std::sort(first, last, comp);
+		return;
+	}
+
+	std::vector<size_t> run_begin(num_runs + 1);
+	for (size_t i = 0 ; i <= num_runs ; i++)
+		run_begin[i] = i * n / num_runs;
+
+	parallel_for(num_runs, num_threads, [&](size_t i)
+	{
+		std::sort(first + run_begin[i], first + run_begin[i + 1], comp);
+	});
+
+	for (size_t width = 1 ; width < num_runs ; width *= 2)
+	{
+		const size_t num_merges = (num_runs + 2 * width - 1) / (2 * width);
+
+		parallel_for(num_merges, num_threads, [&](size_t i)
+		{
+			const size_t lo = 2 * i * width;
+			const size_t mid = std::min(lo + width, num_runs);
+			const size_t hi = std::min(lo + 2 * width, num_runs);
+
+			if (mid < hi)
+				std::inplace_merge(first + run_begin[lo], first + run_begin[mid], first + run_begin[hi], comp);
+		});
+	}
+}
+
+};
+
+#endif // PARALLEL_H_
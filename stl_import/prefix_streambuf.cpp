@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "prefix_streambuf.h"
+
+using namespace std;
+using namespace stl_util;
+
+prefix_streambuf::prefix_streambuf(vector<char> prefix, streambuf* source)
+: m_prefix(std::move(prefix))
+, m_source(source)
+{
+	// The prefix is the first get area
+	setg(m_prefix.data(), m_prefix.data(), m_prefix.data() + m_prefix.size());
+}
+
+prefix_streambuf::int_type prefix_streambuf::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+
+	if (!m_source)
+		return traits_type::eof();
+
+	m_buffer.resize(READ_BLOCK_SIZE);
+	const streamsize num_read = m_source->sgetn(m_buffer.data(), (streamsize) m_buffer.size());
+	if (num_read <= 0)
+		return traits_type::eof();
+
+	setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + num_read);
+
+	return traits_type::to_int_type(*gptr());
+}
+
+streamsize prefix_streambuf::xsgetn(char* s, streamsize n)
+{
+	// Whatever's left of the prefix (or the last small read) first...
+	const streamsize num_buffered = std::min<streamsize>(n, egptr() - gptr());
+	std::memcpy(s, gptr(), (size_t) num_buffered);
+	gbump((int) num_buffered);
+
+	if (num_buffered == n || !m_source)
+		return num_buffered;
+
+	// ...then straight from the source, without copying through m_buffer
+	const streamsize num_read = m_source->sgetn(s + num_buffered, n - num_buffered);
+
+	return num_buffered + std::max<streamsize>(num_read, 0);
+}
+
+streamsize prefix_streambuf::showmanyc()
+{
+	return m_source ? m_source->in_avail() : -1;
+}
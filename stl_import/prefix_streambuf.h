@@ -0,0 +1,41 @@
+#ifndef PREFIX_STREAMBUF_H_
+#define PREFIX_STREAMBUF_H_
+
+#include <streambuf>
+#include <vector>
+
+namespace stl_util
+{
+
+/** A read-only stream buffer that returns the bytes of a prefix, followed by
+ *  whatever is left in a source stream buffer.
+ *
+ *  This puts back the bytes that were read from the front of a stream that
+ *  can't be rewound (a pipe, or a decompressor), e.g. to detect its format.
+ *  Large reads go straight to the source once the prefix has been used up.
+ *  The source must outlive the prefix_streambuf.  Seeking isn't supported.
+ */
+class prefix_streambuf : public std::streambuf
+{
+private:
+	std::vector<char>	m_prefix;
+	std::streambuf*		m_source;
+	std::vector<char>	m_buffer;	// for small reads from the source
+
+	static const size_t	READ_BLOCK_SIZE = 1 << 16;
+
+protected:
+	int_type underflow() override;
+	std::streamsize xsgetn(char* s, std::streamsize n) override;
+	std::streamsize showmanyc() override;
+
+public:
+	prefix_streambuf(std::vector<char> prefix, std::streambuf* source);
+
+	prefix_streambuf(const prefix_streambuf&) = delete;
+	prefix_streambuf& operator=(const prefix_streambuf&) = delete;
+};
+
+};
+
+#endif // PREFIX_STREAMBUF_H_
@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "read_ahead_streambuf.h"
+
+using namespace std;
+using namespace stl_util;
+
+read_ahead_streambuf::read_ahead_streambuf(const string& filename, size_t block_size, unsigned num_blocks)
+: m_fd(-1)
+, m_source(nullptr)
+, m_seekable(false)
+{
+	m_fd = ::open(filename.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		throw std::runtime_error("Error opening file");
+
+	// We're going to read the whole thing front to back (this is only a hint, so it doesn't matter if it fails)
+	::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	const off_t offset = ::lseek(m_fd, 0, SEEK_CUR);
+	m_seekable = offset >= 0;
+
+	init_blocks_(block_size, num_blocks);
+	start_io_(m_seekable ? (std::uint64_t) offset : 0);
+}
+
+read_ahead_streambuf::read_ahead_streambuf(streambuf* source, size_t block_size, unsigned num_blocks)
+: m_fd(-1)
+, m_source(source)
+, m_seekable(false)
+{
+	const pos_type offset = m_source->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+	m_seekable = offset != pos_type(off_type(-1));
+
+	init_blocks_(block_size, num_blocks);
+	start_io_(m_seekable ? (std::uint64_t) (off_type) offset : 0);
+}
+
+read_ahead_streambuf::~read_ahead_streambuf()
+{
+	stop_io_();
+
+	if (m_fd >= 0)
+		::close(m_fd);
+}
+
+void read_ahead_streambuf::init_blocks_(size_t block_size, unsigned num_blocks)
+{
+	// One block for the reader, and at least one for the I/O thread to be filling
+	m_blocks.resize(std::max(2u, num_blocks));
+
+	for (block& b : m_blocks)
+		b.data.resize(std::max<size_t>(1, block_size));
+}
+
+void read_ahead_streambuf::start_io_(std::uint64_t offset)
+{
+	m_num_filled = 0;
+	m_fill_index = 0;
+	m_read_index = 0;
+	m_holding_block = false;
+	m_io_done = false;
+	m_io_error = false;
+	m_stop = false;
+	m_io_offset = offset;
+	m_reader_offset = offset;
+
+	setg(nullptr, nullptr, nullptr);
+
+	m_io_thread = std::thread(&read_ahead_streambuf::io_thread_, this);
+}
+
+bool read_ahead_streambuf::restart_io_(std::uint64_t offset)
+{
+	bool sought;
+	if (m_source)
+		sought = m_source->pubseekpos(pos_type((off_type) offset), std::ios_base::in) == pos_type((off_type) offset);
+	else
+		sought = ::lseek(m_fd, (off_t) offset, SEEK_SET) == (off_t) offset;
+
+	if (!sought)
+		return false;
+
+	start_io_(offset);
+	return true;
+}
+
+void read_ahead_streambuf::stop_io_()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_cond.notify_all();
+
+	if (m_io_thread.joinable())
+		m_io_thread.join();
+}
+
+void read_ahead_streambuf::io_thread_()
+{
+	for (;;)
+	{
+		size_t fill_index;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cond.wait(lock, [this]() { return m_stop || m_num_filled < m_blocks.size(); });
+
+			if (m_stop)
+				return;
+
+			fill_index = m_fill_index;
+		}
+
+		// The reader won't touch this block until we say it's full
+		block& b = m_blocks[fill_index];
+		b.offset = m_io_offset;
+		b.size = read_input_(b.data.data(), b.data.size());
+		m_io_offset += b.size;
+
+		const bool done = b.size < b.data.size();
+		{
+			lock_guard<mutex> lock(m_mutex);
+
+			if (b.size > 0)
+			{
+				m_num_filled++;
+				m_fill_index = (fill_index + 1) % m_blocks.size();
+			}
+
+			m_io_done = done;
+		}
+
+		m_cond.notify_all();
+
+		if (done)
+			return;
+	}
+}
+
+size_t read_ahead_streambuf::read_input_(char* buf, size_t size)
+{
+	size_t num_read = 0;
+
+	// Pipes and network filesystems (and streambufs over them) can return less than
+	// we asked for before the end, so only nothing at all means we're there
+	if (m_source)
+	{
+		// Stream buffers report errors by throwing, which mustn't get out of the I/O thread
+		try
+		{
+			while (num_read < size)
+			{
+				const streamsize n = m_source->sgetn(buf + num_read, (streamsize) (size - num_read));
+				if (n <= 0)
+					break;
+
+				num_read += (size_t) n;
+			}
+		}
+		catch (...)
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_io_error = true;
+		}
+
+		return num_read;
+	}
+
+	while (num_read < size)
+	{
+		const ssize_t n = ::read(m_fd, buf + num_read, size - num_read);
+		if (n == 0)
+			break;
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			lock_guard<mutex> lock(m_mutex);
+			m_io_error = true;
+			break;
+		}
+
+		num_read += (size_t) n;
+	}
+
+	return num_read;
+}
+
+std::uint64_t read_ahead_streambuf::position_() const
+{
+	if (!m_holding_block)
+		return m_reader_offset;
+
+	return m_blocks[m_read_index].offset + (std::uint64_t) (gptr() - eback());
+}
+
+read_ahead_streambuf::int_type read_ahead_streambuf::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+
+	unique_lock<mutex> lock(m_mutex);
+
+	// Hand the block we've finished with back to the I/O thread
+	if (m_holding_block)
+	{
+		const block& b = m_blocks[m_read_index];
+		m_reader_offset = b.offset + b.size;
+
+		m_holding_block = false;
+		m_read_index = (m_read_index + 1) % m_blocks.size();
+		m_num_filled--;
+
+		setg(nullptr, nullptr, nullptr);
+		m_cond.notify_all();
+	}
+
+	m_cond.wait(lock, [this]() { return m_num_filled > 0 || m_io_done; });
+
+	if (m_num_filled == 0)
+		return traits_type::eof();
+
+	block& b = m_blocks[m_read_index];
+	m_holding_block = true;
+	setg(b.data.data(), b.data.data(), b.data.data() + b.size);
+
+	return traits_type::to_int_type(*gptr());
+}
+
+read_ahead_streambuf::pos_type read_ahead_streambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	const pos_type invalid_pos(off_type(-1));
+
+	if (!(which & std::ios_base::in))
+		return invalid_pos;
+
+	const std::uint64_t position = position_();
+
+	// tellg()
+	if (dir == std::ios_base::cur && off == 0)
+		return pos_type((off_type) position);
+
+	if (!m_seekable)
+		return invalid_pos;
+
+	off_type target = -1;
+
+	if (dir == std::ios_base::beg)
+		target = off;
+	else if (dir == std::ios_base::cur)
+		target = (off_type) position + off;
+	else
+	{
+		// We need to know where the end is, which means moving the input out from under the I/O thread
+		stop_io_();
+
+		off_type end;
+		if (m_source)
+			end = (off_type) m_source->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+		else
+			end = (off_type) ::lseek(m_fd, 0, SEEK_END);
+
+		if (end >= 0)
+			target = end + off;
+	}
+
+	if (target < 0)
+	{
+		if (!m_io_thread.joinable())
+			restart_io_(position);	// back to where we were
+
+		return invalid_pos;
+	}
+
+	// We're already there (e.g. rewinding before anything has been read)
+	if (!m_holding_block && m_io_thread.joinable() && (std::uint64_t) target == m_reader_offset)
+		return pos_type(target);
+
+	// Within the block we're reading, we can just move the get pointer
+	if (m_holding_block && m_io_thread.joinable())
+	{
+		const block& b = m_blocks[m_read_index];
+		if ((std::uint64_t) target >= b.offset && (std::uint64_t) target <= b.offset + b.size)
+		{
+			setg(eback(), eback() + (target - (off_type) b.offset), egptr());
+			return pos_type(target);
+		}
+	}
+
+	// Otherwise start reading ahead from the new position
+	stop_io_();
+
+	if (!restart_io_((std::uint64_t) target))
+	{
+		restart_io_(position);
+		return invalid_pos;
+	}
+
+	return pos_type(target);
+}
+
+read_ahead_streambuf::pos_type read_ahead_streambuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+bool read_ahead_streambuf::error() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_io_error;
+}
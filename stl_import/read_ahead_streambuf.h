@@ -0,0 +1,92 @@
+#ifndef READ_AHEAD_STREAMBUF_H_
+#define READ_AHEAD_STREAMBUF_H_
+
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace stl_util
+{
+
+/** A read-only stream buffer that reads ahead on its own I/O thread.
+ *
+ *  The I/O thread fills a ring of reusable blocks from a file (or another stream
+ *  buffer) while the reader works through the blocks that are already full, so
+ *  parsing doesn't stall on every read from a slow disk.  Files are opened with
+ *  a sequential access hint (posix_fadvise).
+ *
+ *  Seeking is supported if the input supports it.  Seeking within the block that
+ *  is being read is free, otherwise the blocks that were read ahead are thrown away.
+ */
+class read_ahead_streambuf : public std::streambuf
+{
+private:
+	struct block
+	{
+		std::vector<char>	data;
+		size_t				size = 0;
+		std::uint64_t		offset = 0;	// position in the input of data[0]
+	};
+
+	int						m_fd;			// -1 when reading from m_source
+	std::streambuf*			m_source;
+	bool					m_seekable;
+	std::vector<block>		m_blocks;
+
+	// Blocks m_read_index, m_read_index + 1, ... (m_num_filled of them) are full.
+	// The I/O thread fills m_fill_index when there's room.
+	mutable std::mutex		m_mutex;
+	std::condition_variable	m_cond;
+	std::thread				m_io_thread;
+	size_t					m_num_filled;
+	size_t					m_fill_index;
+	size_t					m_read_index;
+	bool					m_holding_block;	// the get area is m_blocks[m_read_index]
+	bool					m_io_done;			// the I/O thread reached the end of the input
+	bool					m_io_error;
+	bool					m_stop;
+
+	std::uint64_t			m_io_offset;		// where the I/O thread reads next
+	std::uint64_t			m_reader_offset;	// position when we aren't holding a block
+
+	static const size_t		DEFAULT_BLOCK_SIZE = 1 << 20;
+	static const unsigned	DEFAULT_NUM_BLOCKS = 3;
+
+	void init_blocks_(size_t block_size, unsigned num_blocks);
+	void start_io_(std::uint64_t offset);
+	bool restart_io_(std::uint64_t offset);	// seeks the input first, false if it can't
+	void stop_io_();
+	void io_thread_();
+	size_t read_input_(char* buf, size_t size);	// fills as much of buf as it can, on the I/O thread
+	std::uint64_t position_() const;
+
+protected:
+	int_type underflow() override;
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+public:
+	/** Reads the named file.  Throws std::runtime_error if it can't be opened. */
+	read_ahead_streambuf(const std::string& filename, size_t block_size = DEFAULT_BLOCK_SIZE, unsigned num_blocks = DEFAULT_NUM_BLOCKS);
+
+	/** Reads from source, which must outlive the read_ahead_streambuf and mustn't be used by anything else */
+	read_ahead_streambuf(std::streambuf* source, size_t block_size = DEFAULT_BLOCK_SIZE, unsigned num_blocks = DEFAULT_NUM_BLOCKS);
+
+	~read_ahead_streambuf();
+
+	read_ahead_streambuf(const read_ahead_streambuf&) = delete;
+	read_ahead_streambuf& operator=(const read_ahead_streambuf&) = delete;
+
+	/** Did reading the input fail (as opposed to just reaching the end)?  That includes the
+	 *  source stream buffer throwing.  The reader just sees the end of the input either way.
+	 */
+	bool error() const;
+};
+
+};
+
+#endif // READ_AHEAD_STREAMBUF_H_
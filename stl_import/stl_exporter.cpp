@@ -0,0 +1,233 @@
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "stl_exporter.h"
+#include "stl_generator.h"
+
+using namespace std;
+using namespace stl_util;
+using namespace maths;
+
+namespace
+{
+
+const size_t BINARY_HEADER_SIZE = 80;
+const size_t BINARY_FACET_SIZE = 50;	// normal, 3 vertices, 2 byte attribute count
+
+// Fills coords with the normal and corners of t
+void get_facet_coords(const triangle3d& t, const vector3d& normal, float* coords)
+{
+	for (size_t i = 0 ; i < 3 ; i++)
+	{
+		coords[i] = (float) normal[i];
+
+		for (size_t c = 0 ; c < 3 ; c++)
+			coords[3 + 3 * c + i] = (float) t[c][i];
+	}
+}
+
+// Appends s to buf, returning the new end
+char* append(char* buf, const char* s, size_t len)
+{
+	std::memcpy(buf, s, len);
+	return buf + len;
+}
+
+// The longest a coordinate can get: a space, then the sign, max_digits10 digits,
+// the decimal point and an exponent like "e-38" (e.g. " -1.00211145e-36")
+const size_t MAX_COORD_SIZE = 1 + 1 + std::numeric_limits<float>::max_digits10 + 1 + 4;
+
+// Appends 3 space-separated coordinates, returning the new end
+char* append_coords(char* buf, char* buf_end, const float* coords)
+{
+	for (size_t i = 0 ; i < 3 ; i++)
+	{
+		*buf++ = ' ';
+
+		const std::to_chars_result result = std::to_chars(buf, buf_end, coords[i]);
+		if (result.ec != std::errc())
+			throw std::runtime_error("Error formatting STL coordinate");
+
+		buf = result.ptr;
+	}
+
+	return buf;
+}
+
+};
+
+stl_exporter::stl_exporter(ostream& ostream, stl_format format)
+: m_ostream(ostream)
+, m_format(format)
+{
+	m_buffer.reserve(WRITE_BLOCK_SIZE);
+}
+
+void stl_exporter::flush_buffer_()
+{
+	m_ostream.write(m_buffer.data(), (streamsize) m_buffer.size());
+	m_buffer.clear();
+
+	if (!m_ostream.good())
+		throw std::runtime_error("Error writing STL");
+}
+
+void stl_exporter::write_binary_header_(const string& name, size_t num_facets)
+{
+	if (num_facets > std::numeric_limits<std::uint32_t>::max())
+		throw std::runtime_error("Too many facets for a binary STL");
+
+	char header[BINARY_HEADER_SIZE + 4] = { };
+	std::memcpy(header, name.data(), std::min(name.size(), BINARY_HEADER_SIZE));
+
+	const std::uint32_t facet_count = (std::uint32_t) num_facets;
+	std::memcpy(header + BINARY_HEADER_SIZE, &facet_count, sizeof(facet_count));
+
+	m_buffer.insert(m_buffer.end(), header, header + sizeof(header));
+}
+
+void stl_exporter::write_ascii_facet_(const float* coords)
+{
+	static const char FACET_NORMAL[] = "facet normal";
+	static const char OUTER_LOOP[] = "\n\touter loop\n";
+	static const char VERTEX[] = "\t\tvertex";
+	static const char ENDFACET[] = "\tendloop\nendfacet\n";
+
+	// The fixed text (70 bytes, including the newline after each vertex) plus 12 of the longest coordinates
+	const size_t MAX_FACET_SIZE = (sizeof(FACET_NORMAL) - 1) + (sizeof(OUTER_LOOP) - 1) + 3 * (sizeof(VERTEX) - 1 + 1) +
+								  (sizeof(ENDFACET) - 1) + 12 * MAX_COORD_SIZE;
+
+	const size_t size = m_buffer.size();
+	m_buffer.resize(size + MAX_FACET_SIZE);
+
+	char* const begin = m_buffer.data() + size;
+	char* const end = begin + MAX_FACET_SIZE;
+	char* buf = begin;
+
+	buf = append(buf, FACET_NORMAL, sizeof(FACET_NORMAL) - 1);
+	buf = append_coords(buf, end, coords);
+	buf = append(buf, OUTER_LOOP, sizeof(OUTER_LOOP) - 1);
+
+	for (size_t c = 0 ; c < 3 ; c++)
+	{
+		buf = append(buf, VERTEX, sizeof(VERTEX) - 1);
+		buf = append_coords(buf, end, coords + 3 + 3 * c);
+		*buf++ = '\n';
+	}
+
+	buf = append(buf, ENDFACET, sizeof(ENDFACET) - 1);
+
+	m_buffer.resize(size + (buf - begin));
+}
+
+template <typename GetFacet>
+void stl_exporter::write_(const string& name, size_t num_facets, GetFacet get_facet)
+{
+	m_buffer.clear();
+
+	float coords[12];
+	std::uint16_t attribute = 0;
+
+	if (m_format == stl_format::binary)
+	{
+		write_binary_header_(name, num_facets);
+
+		for (size_t f = 0 ; f < num_facets ; f++)
+		{
+			get_facet(f, coords, attribute);
+
+			const size_t size = m_buffer.size();
+			m_buffer.resize(size + BINARY_FACET_SIZE);
+			std::memcpy(&m_buffer[size], coords, sizeof(coords));
+			std::memcpy(&m_buffer[size + sizeof(coords)], &attribute, sizeof(attribute));
+
+			if (m_buffer.size() >= WRITE_BLOCK_SIZE)
+				flush_buffer_();
+		}
+	}
+	else
+	{
+		const string solid_line = "solid " + name + "\n";
+		m_buffer.insert(m_buffer.end(), solid_line.begin(), solid_line.end());
+
+		for (size_t f = 0 ; f < num_facets ; f++)
+		{
+			get_facet(f, coords, attribute);
+			write_ascii_facet_(coords);
+
+			if (m_buffer.size() >= WRITE_BLOCK_SIZE)
+				flush_buffer_();
+		}
+
+		const string endsolid_line = "endsolid " + name + "\n";
+		m_buffer.insert(m_buffer.end(), endsolid_line.begin(), endsolid_line.end());
+	}
+
+	flush_buffer_();
+}
+
+void stl_exporter::write(const triangle_mesh& mesh)
+{
+	const vector<mesh_facet_ptr>& facets = mesh.get_facets();
+
+	write_(mesh.name(), facets.size(), [&](size_t f, float* coords, std::uint16_t& attribute)
+	{
+		get_facet_coords(facets[f]->get_triangle(), facets[f]->get_normal(), coords);
+		attribute = 0;
+	});
+}
+
+void stl_exporter::write(const compact_mesh& mesh)
+{
+	write_(mesh.name(), mesh.num_facets(), [&](size_t f, float* coords, std::uint16_t& attribute)
+	{
+		get_facet_coords(mesh.get_triangle((compact_mesh::index_t) f), mesh.get_facet_normal((compact_mesh::index_t) f), coords);
+		attribute = 0;
+	});
+}
+
+void stl_exporter::write(const triangle_soup& soup)
+{
+	const float* x = soup.x();
+	const float* y = soup.y();
+	const float* z = soup.z();
+
+	write_(soup.name(), soup.size(), [&](size_t f, float* coords, std::uint16_t& attribute)
+	{
+		const vector3d normal = soup.get_normal(f);
+		for (size_t i = 0 ; i < 3 ; i++)
+			coords[i] = (float) normal[i];
+
+		// Straight from the soup's floats
+		for (size_t c = 0 ; c < 3 ; c++)
+		{
+			coords[3 + 3 * c] = x[3 * f + c];
+			coords[4 + 3 * c] = y[3 * f + c];
+			coords[5 + 3 * c] = z[3 * f + c];
+		}
+
+		attribute = soup.get_attribute(f);
+	});
+}
+
+void stl_exporter::write(const vector<triangle3d>& triangles, const string& name)
+{
+	write_(name, triangles.size(), [&](size_t f, float* coords, std::uint16_t& attribute)
+	{
+		get_facet_coords(triangles[f], triangles[f].normal(), coords);
+		attribute = 0;
+	});
+}
+
+void stl_exporter::write(const stl_generator& generator)
+{
+	write_(generator.name(), generator.num_facets(), [&](size_t f, float* coords, std::uint16_t& attribute)
+	{
+		const triangle3d triangle = generator.get_triangle(f);
+		get_facet_coords(triangle, triangle.normal(), coords);
+		attribute = 0;
+	});
+}
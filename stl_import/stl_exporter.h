@@ -0,0 +1,68 @@
+#ifndef STL_EXPORTER_H_
+#define STL_EXPORTER_H_
+
+#include <vector>
+#include <string>
+#include <ostream>
+
+#include "geom.h"
+#include "triangle_mesh.h"
+#include "compact_mesh.h"
+#include "triangle_soup.h"
+
+namespace stl_util
+{
+
+class stl_generator;
+
+enum class stl_format
+{
+	binary,
+	ascii
+};
+
+/** Writes meshes and triangle soups as STLs.
+ *
+ *  Facets are formatted into a large buffer which is written to the stream a block
+ *  at a time, so the stream is never flushed per line.  Binary facet records are packed
+ *  directly, and ASCII coordinates are formatted with std::to_chars, as the shortest
+ *  text that reads back as the same float (which is all the precision an STL has).
+ *
+ *  The mesh name goes in the solid / endsolid lines of ASCII STLs and in the
+ *  80 byte header of binary STLs (truncated if necessary).
+ *
+ *  Throws std::runtime_error if the stream can't be written to.
+ */
+class stl_exporter
+{
+private:
+	std::ostream&		m_ostream;
+	stl_format			m_format;
+	std::vector<char>	m_buffer;
+
+	static const size_t	WRITE_BLOCK_SIZE = 1 << 20;
+
+	/** Writes num_facets facets, where get_facet(f, coords, attribute) fills in the
+	 *  normal and 3 corners of facet f (12 floats) and its attribute byte count */
+	template <typename GetFacet>
+	void write_(const std::string& name, size_t num_facets, GetFacet get_facet);
+
+	void write_binary_header_(const std::string& name, size_t num_facets);
+	void write_ascii_facet_(const float* coords);
+	void flush_buffer_();
+
+public:
+	stl_exporter(std::ostream& ostream, stl_format format = stl_format::binary);
+
+	stl_format format() const { return m_format; }
+
+	void write(const triangle_mesh& mesh);
+	void write(const compact_mesh& mesh);
+	void write(const triangle_soup& soup);	// with the soup's attribute byte counts, if it has them
+	void write(const std::vector<maths::triangle3d>& triangles, const std::string& name = std::string());
+	void write(const stl_generator& generator);	// one facet at a time, so any size can be written
+};
+
+};
+
+#endif // STL_EXPORTER_H_
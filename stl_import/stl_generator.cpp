@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+
+#include "stl_generator.h"
+
+using namespace std;
+using namespace stl_util;
+using namespace maths;
+
+namespace
+{
+
+const double TORUS_MAJOR_RADIUS = 1.0;
+const double TORUS_MINOR_RADIUS = 0.25;
+
+// The closest whole number of rows to sqrt(n / divisor), but at least min_rows
+size_t get_num_rows(size_t num_facets, double divisor, size_t min_rows)
+{
+	return std::max(min_rows, (size_t) std::llround(std::sqrt((double) num_facets / divisor)));
+}
+
+// splitmix64, which is plenty random for jitter and can be computed from any index
+std::uint64_t mix(std::uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// Uniformly distributed in [-1, 1]
+double random_unit(std::uint64_t x)
+{
+	return (double) (mix(x) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+};
+
+stl_generator::stl_generator(generated_shape shape, size_t num_facets, std::uint64_t seed)
+: m_shape(shape)
+, m_rows(0)
+, m_columns(0)
+, m_num_facets(0)
+, m_jitter(0.0)
+, m_seed(seed)
+, m_name(string("generated_") + shape_name(shape))
+{
+	if (num_facets == 0)
+		throw std::invalid_argument("Can't generate an empty STL");
+
+	switch (m_shape)
+	{
+	case generated_shape::sphere:
+	case generated_shape::jittered_soup:
+		// Twice as many columns as rows, with single facets around the poles
+		m_rows = get_num_rows(num_facets, 4.0, 2);
+		m_columns = 2 * m_rows;
+		m_num_facets = 2 * m_columns * (m_rows - 1);
+		break;
+
+	case generated_shape::torus:
+		// The major circumference is 4 times the minor one, so this keeps the cells square
+		m_rows = get_num_rows(num_facets, 8.0, 3);
+		m_columns = 4 * m_rows;
+		m_num_facets = 2 * m_rows * m_columns;
+		break;
+
+	case generated_shape::grid:
+		m_rows = get_num_rows(num_facets, 2.0, 1);
+		m_columns = m_rows;
+		m_num_facets = 2 * m_rows * m_columns;
+		break;
+
+	case generated_shape::non_manifold:
+		m_rows = get_num_rows(num_facets, 3.0, 1);
+		m_columns = m_rows;
+		m_num_facets = 3 * m_rows * m_columns;
+		break;
+	}
+
+	if (m_shape == generated_shape::jittered_soup)
+		m_jitter = DEFAULT_SOUP_JITTER;
+}
+
+void stl_generator::set_jitter(double jitter)
+{
+	if (!(jitter >= 0.0))
+		throw std::invalid_argument("Jitter must be non-negative");
+
+	m_jitter = jitter;
+}
+
+vector3d stl_generator::get_point_(size_t row, size_t column) const
+{
+	switch (m_shape)
+	{
+	case generated_shape::sphere:
+	case generated_shape::jittered_soup:
+	{
+		// Exactly on the poles, so that every facet around them meets there
+		if (row == 0)
+			return vector3d(0.0, 0.0, 1.0);
+		if (row == m_rows)
+			return vector3d(0.0, 0.0, -1.0);
+
+		const double phi = M_PI * (double) row / (double) m_rows;
+		const double theta = 2.0 * M_PI * (double) (column % m_columns) / (double) m_columns;
+
+		return vector3d(std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta), std::cos(phi));
+	}
+
+	case generated_shape::torus:
+	{
+		const double u = 2.0 * M_PI * (double) (column % m_columns) / (double) m_columns;
+		const double v = 2.0 * M_PI * (double) (row % m_rows) / (double) m_rows;
+		const double r = TORUS_MAJOR_RADIUS + TORUS_MINOR_RADIUS * std::cos(v);
+
+		return vector3d(r * std::cos(u), r * std::sin(u), TORUS_MINOR_RADIUS * std::sin(v));
+	}
+
+	case generated_shape::grid:
+	case generated_shape::non_manifold:
+		break;
+	}
+
+	return vector3d((double) column / (double) m_columns, (double) row / (double) m_rows, 0.0);
+}
+
+vector3d stl_generator::get_jitter_(size_t facet, size_t corner) const
+{
+	const std::uint64_t key = mix(m_seed) ^ ((std::uint64_t) (3 * facet + corner) * 3);
+
+	return vector3d(random_unit(key) * m_jitter, random_unit(key + 1) * m_jitter, random_unit(key + 2) * m_jitter);
+}
+
+triangle3d stl_generator::get_sphere_triangle_(size_t f) const
+{
+	// Facets go top cap, then the rows of cells, then the bottom cap
+	const size_t cap_facets = m_columns;
+	const size_t body_facets = 2 * m_columns * (m_rows - 2);
+
+	if (f < cap_facets)
+		return triangle3d(get_point_(0, f), get_point_(1, f), get_point_(1, f + 1));
+
+	if (f >= cap_facets + body_facets)
+	{
+		const size_t column = f - cap_facets - body_facets;
+		return triangle3d(get_point_(m_rows - 1, column), get_point_(m_rows, column), get_point_(m_rows - 1, column + 1));
+	}
+
+	const size_t cell = (f - cap_facets) / 2;
+	const size_t row = 1 + cell / m_columns;
+	const size_t column = cell % m_columns;
+
+	if ((f - cap_facets) % 2 == 0)
+		return triangle3d(get_point_(row, column), get_point_(row + 1, column), get_point_(row + 1, column + 1));
+
+	return triangle3d(get_point_(row, column), get_point_(row + 1, column + 1), get_point_(row, column + 1));
+}
+
+triangle3d stl_generator::get_grid_triangle_(size_t f) const
+{
+	const size_t cell = f / 2;
+	const size_t row = cell / m_columns;
+	const size_t column = cell % m_columns;
+
+	if (f % 2 == 0)
+		return triangle3d(get_point_(row, column), get_point_(row, column + 1), get_point_(row + 1, column + 1));
+
+	return triangle3d(get_point_(row, column), get_point_(row + 1, column + 1), get_point_(row + 1, column));
+}
+
+triangle3d stl_generator::get_non_manifold_triangle_(size_t f) const
+{
+	const size_t cell = f / 3;
+
+	if (f % 3 < 2)
+		return get_grid_triangle_(2 * cell + f % 3);
+
+	// The fin stands up on the cell's diagonal
+	const size_t row = cell / m_columns;
+	const size_t column = cell % m_columns;
+
+	const vector3d p0 = get_point_(row, column);
+	const vector3d p1 = get_point_(row + 1, column + 1);
+	const vector3d apex = (p0 + p1) * 0.5 + vector3d(0.0, 0.0, 1.0 / (double) m_columns);
+
+	return triangle3d(p0, p1, apex);
+}
+
+triangle3d stl_generator::get_shape_triangle_(size_t f) const
+{
+	switch (m_shape)
+	{
+	case generated_shape::sphere:
+	case generated_shape::jittered_soup:
+		return get_sphere_triangle_(f);
+
+	case generated_shape::non_manifold:
+		return get_non_manifold_triangle_(f);
+
+	case generated_shape::torus:
+	case generated_shape::grid:
+		break;
+	}
+
+	return get_grid_triangle_(f);
+}
+
+triangle3d stl_generator::get_triangle(size_t f) const
+{
+	if (f >= m_num_facets)
+		throw std::out_of_range("Facet index out of range");
+
+	const triangle3d triangle = get_shape_triangle_(f);
+	if (m_jitter == 0.0)
+		return triangle;
+
+	return triangle3d(triangle[0] + get_jitter_(f, 0), triangle[1] + get_jitter_(f, 1), triangle[2] + get_jitter_(f, 2));
+}
+
+vector<triangle3d> stl_generator::get_triangles() const
+{
+	vector<triangle3d> triangles;
+	triangles.reserve(m_num_facets);
+	generate(back_inserter(triangles));
+
+	return triangles;
+}
+
+bool stl_generator::parse_shape(const string& name, generated_shape& shape)
+{
+	for (auto s : { generated_shape::sphere, generated_shape::torus, generated_shape::grid,
+					generated_shape::non_manifold, generated_shape::jittered_soup })
+	{
+		if (name == shape_name(s))
+		{
+			shape = s;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char* stl_generator::shape_name(generated_shape shape)
+{
+	switch (shape)
+	{
+	case generated_shape::sphere:			return "sphere";
+	case generated_shape::torus:			return "torus";
+	case generated_shape::grid:				return "grid";
+	case generated_shape::non_manifold:		return "non_manifold";
+	case generated_shape::jittered_soup:	return "jittered_soup";
+	}
+
+	return "unknown";
+}
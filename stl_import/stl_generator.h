@@ -0,0 +1,100 @@
+#ifndef STL_GENERATOR_H_
+#define STL_GENERATOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "geom.h"
+
+namespace stl_util
+{
+
+/** The kinds of surface that stl_generator can make */
+enum class generated_shape
+{
+	sphere,			/**< Closed unit sphere, tessellated by latitude and longitude */
+	torus,			/**< Closed torus, with major radius 1 and minor radius 0.25 */
+	grid,			/**< Open unit square in the XY plane, two facets per cell */
+	non_manifold,	/**< Grid with a fin standing on each cell's diagonal, so three facets share every diagonal edge */
+	jittered_soup	/**< Sphere with every facet corner moved independently, so no vertices are shared */
+};
+
+/** Generates large synthetic STLs for scale testing.
+ *
+ *  Facets are computed from their index on demand, so STLs with hundreds of
+ *  millions of facets can be written (see stl_exporter) without ever being held
+ *  in memory.  Shapes are tessellated into rows and columns of cells, so the number
+ *  of facets is as close to the requested number as the tessellation allows.
+ *  Shared vertices are computed identically for every facet that uses them, so
+ *  apart from jittered_soup they are bitwise identical in the output.
+ *
+ *  All output is deterministic for a given shape, facet count, jitter and seed.
+ */
+class stl_generator
+{
+private:
+	generated_shape	m_shape;
+	size_t			m_rows;
+	size_t			m_columns;
+	size_t			m_num_facets;
+	double			m_jitter;
+	std::uint64_t	m_seed;
+	std::string		m_name;
+
+	static constexpr double	DEFAULT_SOUP_JITTER = 1e-5;
+
+	maths::vector3d get_point_(size_t row, size_t column) const;	// shared vertex at a cell corner
+	maths::vector3d get_jitter_(size_t facet, size_t corner) const;
+
+	maths::triangle3d get_sphere_triangle_(size_t facet) const;
+	maths::triangle3d get_grid_triangle_(size_t facet) const;
+	maths::triangle3d get_non_manifold_triangle_(size_t facet) const;
+	maths::triangle3d get_shape_triangle_(size_t facet) const;		// before jitter
+
+public:
+	/** Makes a generator for about num_facets facets of the given shape.
+	 *  Throws std::invalid_argument if num_facets is 0.
+	 */
+	stl_generator(generated_shape shape, size_t num_facets, std::uint64_t seed = 0);
+
+	generated_shape shape() const { return m_shape; }
+
+	/** The number of facets that will actually be generated */
+	size_t num_facets() const { return m_num_facets; }
+
+	/** Moves each facet corner by up to jitter along each axis.  Corners are moved
+	 *  independently, so shared vertices no longer match exactly.
+	 *  jittered_soup starts out with a small jitter, every other shape with none.
+	 */
+	void set_jitter(double jitter);
+	double jitter() const { return m_jitter; }
+
+	std::uint64_t seed() const { return m_seed; }
+
+	std::string& name() { return m_name; }
+	const std::string& name() const { return m_name; }
+
+	/** Facet f of the shape, with outward-facing winding for the closed shapes */
+	maths::triangle3d get_triangle(size_t f) const;
+
+	/** Outputs all of the facets in order */
+	template <typename OutputIterator>
+	void generate(OutputIterator oi) const
+	{
+		for (size_t f = 0 ; f < m_num_facets ; f++)
+			*oi++ = get_triangle(f);
+	}
+
+	std::vector<maths::triangle3d> get_triangles() const;
+
+	/** Converts shape names ("sphere", "torus", "grid", "non_manifold", "jittered_soup")
+	 *  to and from generated_shape.  parse_shape() returns false for unknown names.
+	 */
+	static bool parse_shape(const std::string& name, generated_shape& shape);
+	static const char* shape_name(generated_shape shape);
+};
+
+};
+
+#endif // STL_GENERATOR_H_
@@ -3,44 +3,156 @@
 #include <fstream>
 #include <iterator>
 #include <algorithm>
+#include <cstring>
+#include <charconv>
+#include <limits>
 
-#include <stlutil/getline_crlf_lf.h>
-#include <stlutil/finally.h>
 #include <stlutil/make_unique.h>
 
 #include "stl_importer.h"
 
 using namespace std;
 using namespace stl_util;	// change this...
-using namespace stlutil;
 using namespace maths;
 
+//////////////////////////
+// stl_reader_interface
+
+size_t stl_reader_interface::read_facets(triangle_soup& soup, size_t max_facets)
+{
+	const size_t MAX_FACETS_PER_READ = 4096;
+
+	vector<triangle3d> triangles(std::min(max_facets, MAX_FACETS_PER_READ));
+	vector<vector3d> normals(soup.has_normals() ? triangles.size() : 0);
+
+	size_t num_read = 0;
+	while (num_read < max_facets && !done())
+	{
+		const size_t num_to_read = std::min(max_facets - num_read, triangles.size());
+		const size_t num_facets = read_facets(triangles.data(), soup.has_normals() ? normals.data() : nullptr, num_to_read);
+
+		for (size_t i = 0 ; i < num_facets ; i++)
+		{
+			if (soup.has_normals())
+				soup.push_back(triangles[i], normals[i]);
+			else
+				soup.push_back(triangles[i]);
+		}
+
+		num_read += num_facets;
+	}
+
+	return num_read;
+}
 
 //////////////////////////
 // ascii_stl_reader
 
 ascii_stl_reader::ascii_stl_reader(istream& istream)
-: m_istream(istream)
+: m_istream(&istream)
+, m_begin(nullptr)
+, m_pos(nullptr)
+, m_end(nullptr)
+, m_bytes_discarded(0)
+, m_lines_read(0)
 , m_done(false)
 {
 
 }
 
-string ascii_stl_reader::get_next_line()
+ascii_stl_reader::ascii_stl_reader(const char* data, size_t size)
+: m_istream(nullptr)
+, m_begin(data)
+, m_pos(data)
+, m_end(data + size)
+, m_bytes_discarded(0)
+, m_lines_read(0)
+, m_done(false)
 {
-	string line;
 
-	while (line.empty())
+}
+
+bool ascii_stl_reader::fill_buffer_()
+{
+	if (!m_istream || !m_istream->good())
+		return false;
+
+	// Move whatever we haven't parsed yet to the front of the buffer
+	const size_t remaining = m_end - m_pos;
+	m_bytes_discarded += m_pos - m_buffer.data();
+
+	if (remaining > 0 && m_pos != m_buffer.data())
+		std::memmove(m_buffer.data(), m_pos, remaining);
+
+	if (m_buffer.size() < remaining + READ_BLOCK_SIZE)
 	{
-		getline_crlf_lf(m_istream, line);
+		m_buffer.resize(remaining + READ_BLOCK_SIZE);
+		STL_IMPORT_STAT(if (m_stats) m_stats->buffer_allocations++);
+	}
+
+	m_istream->read(m_buffer.data() + remaining, READ_BLOCK_SIZE);
+	const size_t num_read = (size_t) m_istream->gcount();
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += num_read);
+
+	m_pos = m_buffer.data();
+	m_end = m_pos + remaining + num_read;
+
+	return num_read > 0;
+}
 
-		if (m_istream.eof())
-			break;
+string_view ascii_stl_reader::get_next_line_()
+{
+	for (;;)
+	{
+		const char* eol = (m_pos != m_end) ? static_cast<const char*>(std::memchr(m_pos, '\n', m_end - m_pos)) : nullptr;
+		if (!eol)
+		{
+			if (fill_buffer_())
+				continue;
+
+			if (m_pos == m_end)
+				return string_view();
+
+			eol = m_end;	// last line, with no line terminator
+		}
+
+		const char* line_begin = m_pos;
+		const char* line_end = eol;
+		m_pos = (eol == m_end) ? m_end : eol + 1;
+
+		// Trim whitespace (including any CR from a CRLF line ending)
+		while (line_begin < line_end && ::isspace((unsigned char) *line_begin))
+			line_begin++;
+		while (line_end > line_begin && ::isspace((unsigned char) *(line_end - 1)))
+			line_end--;
+
+		if (line_begin != line_end)
+		{
+			STL_IMPORT_STAT(m_lines_read++);
+			return string_view(line_begin, line_end - line_begin);
+		}
+
+		STL_IMPORT_STAT(if (m_stats) m_stats->lines_skipped++);
+	}
+}
+
+void ascii_stl_reader::rewind_()
+{
+	if (m_istream)
+	{
+		// Anything we've buffered is no good after the stream is repositioned
+		m_pos = m_end = m_buffer.data();
+		m_bytes_discarded = 0;
 	}
+	else
+		m_pos = m_begin;
 
-	prep_line_(line);
+	m_done = false;
+}
 
-	return line;
+size_t ascii_stl_reader::bytes_read() const
+{
+	return m_istream ? m_bytes_discarded + (m_pos - m_buffer.data()) : m_pos - m_begin;
 }
 
 //static
@@ -74,31 +186,71 @@ vector<string> ascii_stl_reader::tokenize_line_(const string& line)
 	return tokens;
 }
 
-bool ascii_stl_reader::read_header(string& name)
+//static
+string_view ascii_stl_reader::next_token_(string_view& line)
 {
-	std::string solid_line;
-	getline_crlf_lf(m_istream, solid_line);
+	auto is_sep = [](char c) { return c == ' ' || c == '\t'; };
+
+	size_t tok_begin = 0;
+	while (tok_begin < line.size() && is_sep(line[tok_begin]))
+		tok_begin++;
+
+	size_t tok_end = tok_begin;
+	while (tok_end < line.size() && !is_sep(line[tok_end]))
+		tok_end++;
 
-	// It doesn't make sense to do most of the things that we do in prep_line
-	// for "solid", but we still want to convert tabs to spaces for tokenization
-	std::replace(solid_line.begin(), solid_line.end(), '\t', ' ');
+	string_view token = line.substr(tok_begin, tok_end - tok_begin);
+	line.remove_prefix(tok_end);
 
-	auto tokens = tokenize_line_(solid_line);
+	return token;
+}
 
-	if (tokens.empty() || tokens[0] != "solid")
+//static
+bool ascii_stl_reader::token_is_(string_view token, string_view keyword)
+{
+	if (token.size() != keyword.size())
 		return false;
 
-	// Concatenate the rest of the tokens (if there are any) into the solid name
-	string solid_name = accumulate(tokens.begin() + 1, tokens.end(), string(),
-		[](string out_name, const string& tok)
-		{
-			if (!out_name.empty())
-				out_name += " ";
+	// Keywords are all letters, so setting the case bit is enough to lowercase the token
+	for (size_t i = 0 ; i < token.size() ; i++)
+	{
+		if ((token[i] | 0x20) != keyword[i])
+			return false;
+	}
+
+	return true;
+}
+
+//static
+bool ascii_stl_reader::parse_double_(string_view token, double& d)
+{
+	// from_chars() doesn't accept a leading '+', but operator>> does
+	if (!token.empty() && token[0] == '+')
+		token.remove_prefix(1);
+
+	auto result = std::from_chars(token.data(), token.data() + token.size(), d);
+
+	return result.ec == std::errc();
+}
 
-			out_name += tok;
+bool ascii_stl_reader::read_header(string& name)
+{
+	rewind_();
 
-			return out_name;
-		});
+	string_view solid_line = get_next_line_();
+
+	if (!token_is_(next_token_(solid_line), "solid"))
+		return false;
+
+	// Concatenate the rest of the tokens (if there are any) into the solid name
+	string solid_name;
+	for (string_view tok = next_token_(solid_line) ; !tok.empty() ; tok = next_token_(solid_line))
+	{
+		if (!solid_name.empty())
+			solid_name += " ";
+
+		solid_name.append(tok.data(), tok.size());
+	}
 
 	name = solid_name;
 
@@ -107,9 +259,10 @@ bool ascii_stl_reader::read_header(string& name)
 
 bool ascii_stl_reader::read_facet(triangle3d& triangle, vector3d& normal)
 {
-	string line = get_next_line();
+	string_view line = get_next_line_();
+	string_view tok = next_token_(line);
 
-	if (line == "endsolid" || line.empty())
+	if (tok.empty() || (token_is_(tok, "endsolid") && next_token_(line).empty()))
 	{
 		m_done = true;
 		return false;
@@ -117,108 +270,168 @@ bool ascii_stl_reader::read_facet(triangle3d& triangle, vector3d& normal)
 
 	{
 		// Read "facet normal"
-		vector<string> fn_tokens = tokenize_line_(line);
-		if (fn_tokens.size() != 5)
+		if (!token_is_(tok, "facet"))
 			return false;
-
-		if (fn_tokens[0] != "facet")
-			return false;
-		if (fn_tokens[1] != "normal")
+		if (!token_is_(next_token_(line), "normal"))
 			return false;
 
-		auto fn_begin = fn_tokens.begin() + 2;
-
 		for (size_t i = 0 ; i < 3 ; i++)
 		{
-			istringstream double_str(*(fn_begin + i));
-			if (!(double_str >> normal[i]))
+			if (!parse_double_(next_token_(line), normal[i]))
 				return false;
 		}
-	}
 
-	line = get_next_line();
-	if (done())
-		return false;
+		if (!next_token_(line).empty())
+			return false;
+	}
 
 	{
 		// Read "outer loop"
-		if (line != "outer loop")
+		line = get_next_line_();
+		if (!token_is_(next_token_(line), "outer"))
+			return false;
+		if (!token_is_(next_token_(line), "loop") || !next_token_(line).empty())
 			return false;
 	}
 
 	// Read vertices
-	vector<maths::vector3d> t_verts(3);
+	vector3d t_verts[3];
 
 	for (int i = 0 ; i < 3 ; i++)
 	{
-		line = get_next_line();
-		auto tokens = tokenize_line_(line);
-
-		if (tokens[0] != "vertex")
+		line = get_next_line_();
+		if (!token_is_(next_token_(line), "vertex"))
 			return false;
 
-		auto v_tok = tokens.begin() + 1;
-
 		for (int j = 0 ; j < 3 ; j++)
 		{
-			istringstream ss(*(v_tok + j));
-			if (!(ss >> t_verts[i][j]))
+			if (!parse_double_(next_token_(line), t_verts[i][j]))
 				return false;
 		}
 	}
 
 	triangle = triangle3d(t_verts[0], t_verts[1], t_verts[2]);
 
-	line = get_next_line();
-	if (done())
-		return false;
-
 	// Read "endloop" and "endfacet"
-	if (line != "endloop")
-		return false;
-
-	line = get_next_line();
-	if (done())
+	line = get_next_line_();
+	if (!token_is_(next_token_(line), "endloop") || !next_token_(line).empty())
 		return false;
 
-	if (line != "endfacet")
+	line = get_next_line_();
+	if (!token_is_(next_token_(line), "endfacet") || !next_token_(line).empty())
 		return false;
 
 	return true;
 }
 
+size_t ascii_stl_reader::read_facets(triangle3d* triangles, vector3d* normals, size_t max_facets)
+{
+	size_t num_read = 0;
+	vector3d normal;
+
+	while (num_read < max_facets && !done())
+	{
+		STL_IMPORT_STAT(const size_t facet_first_line = m_lines_read);
+
+		if (ascii_stl_reader::read_facet(triangles[num_read], normals ? normals[num_read] : normal))
+			num_read++;
+		else
+			STL_IMPORT_STAT(if (m_stats && !m_done) m_stats->lines_skipped += m_lines_read - facet_first_line);
+	}
+
+	return num_read;
+}
+
 bool ascii_stl_reader::done() const
 {
-	return m_done || m_istream.eof();
+	return m_done || (m_pos == m_end && (!m_istream || !m_istream->good()));
 }
 
 size_t ascii_stl_reader::get_file_facet_count()
 {
 	size_t facet_count = 0;
 
-	m_istream.seekg(0);	// rewind the stream
-
-	while (!m_istream.eof())
+	// rewind the stream
+	if (m_istream)
 	{
-		string line = get_next_line();
-		if (line.size() < 5)
-			continue;
+		m_istream->clear();
+		m_istream->seekg(0);
+	}
+	rewind_();
 
-		string facet_substr(line.begin(), line.begin() + 5);
-		if (facet_substr == "facet")
+	for (string_view line = get_next_line_() ; !line.empty() ; line = get_next_line_())
+	{
+		if (line.size() >= 5 && token_is_(line.substr(0, 5), "facet"))
 			facet_count++;
 	}
 
-	m_istream.seekg(0);
+	if (m_istream)
+	{
+		m_istream->clear();
+		m_istream->seekg(0);
+	}
+	rewind_();
 
 	return facet_count;
 }
 
+//////////////////////////////
+// binary STL helpers
+
+namespace
+{
+
+// Pulls the solid name out of the 80 byte binary STL header
+string binary_header_name(const char* header_buf)
+{
+	// The header isn't necessarily NUL-terminated
+	string name(header_buf, std::find(header_buf, header_buf + 80, '\0'));
+
+	// Sometimes there is junk after the name.  Chop of any non-printable characters.
+	auto npc = std::find_if(name.begin(), name.end(), [](char c) { return !::isprint(c); });
+	if (npc != name.end())
+		name.resize(std::distance(name.begin(), npc));
+
+	// Gratuitous whitespace
+	auto spaces = std::adjacent_find(name.begin(), name.end(), [](char a, char b) { return ::isspace(a) && ::isspace(b); });
+	if (spaces != name.end())
+		name.resize(std::distance(name.begin(), spaces));
+
+	return name;
+}
+
+// Decodes a single 50 byte facet record (normal, 3 vertices, attribute byte count)
+void decode_binary_facet(const char* facet_buf, triangle3d& triangle, vector3d& normal)
+{
+	float f[12];
+	std::memcpy(f, facet_buf, sizeof(f));	// facet_buf isn't necessarily aligned
+
+	normal = vector3d(f[0], f[1], f[2]);
+	triangle = triangle3d(vector3d(f[3], f[4], f[5]),
+						  vector3d(f[6], f[7], f[8]),
+						  vector3d(f[9], f[10], f[11]));
+}
+
+// Decodes a facet record straight into facet f of soup, without going through doubles
+void decode_binary_facet(const char* facet_buf, triangle_soup& soup, size_t f)
+{
+	float coords[12];
+	std::memcpy(coords, facet_buf, sizeof(coords));
+
+	std::uint16_t attribute;
+	std::memcpy(&attribute, facet_buf + sizeof(coords), sizeof(attribute));
+
+	soup.set_facet(f, coords + 3, coords, attribute);
+}
+
+};
+
 //////////////////////////////
 // binary_stl_reader
 binary_stl_reader::binary_stl_reader(istream& istream)
 : m_istream(istream)
 , m_num_facets(0)
+, m_bytes_read(0)
 {
 	// Unfortunately, there is no way to test if the stream was opened in binary mode...
 }
@@ -227,68 +440,99 @@ bool binary_stl_reader::read_header(string& name)
 {
 	char header_buf[80];
 	m_istream.read(header_buf, 80);
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += (size_t) m_istream.gcount());
 
 	if (!m_istream.good())
 		return false;
 
-	name = header_buf;
-
-	// Sometimes there is junk after the name.  Chop of any non-printable characters.
-	auto npc = std::find_if(name.begin(), name.end(), [](char c) { return !::isprint(c); });
-	if (npc != name.end())
-		name.resize(std::distance(name.begin(), npc));
-
-	// Gratuitous whitespace
-	auto spaces = std::adjacent_find(name.begin(), name.end(), [](char a, char b) { return ::isspace(a) && ::isspace(b); });
-	if (spaces != name.end())
-		name.resize(std::distance(name.begin(), spaces));
+	name = binary_header_name(header_buf);
 
 	// Read the expected number of triangles while we're at it
 	// It should be immediately after the header
 	char facet_count_buf[4];
 	m_istream.read(facet_count_buf, 4);
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += (size_t) m_istream.gcount());
 
 	if (!m_istream.good())
 		return false;
 
-	auto num_facets = reinterpret_cast<uint32_t*>(facet_count_buf);
-	m_num_facets = *num_facets;
+	std::memcpy(&m_num_facets, facet_count_buf, 4);
+	m_bytes_read = mapped_binary_stl_reader::HEADER_SIZE;
 
 	return true;
 }
 
 bool binary_stl_reader::read_facet(triangle3d& triangle, vector3d& normal)
 {
-	char vector_buf[12];
+	// Read the whole facet record (including the attribute byte count) at once
+	char facet_buf[mapped_binary_stl_reader::FACET_SIZE];
+	m_istream.read(facet_buf, sizeof(facet_buf));
+	m_bytes_read += (size_t) m_istream.gcount();
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += (size_t) m_istream.gcount());
 
-	// read normal
-	m_istream.read(vector_buf, 12);
 	if (!m_istream.good())
 		return false;
 
-	auto vector_arr = reinterpret_cast<float*>(vector_buf);
-	normal = maths::convert<double, float>(vector3f(vector_arr[0], vector_arr[1], vector_arr[2]));
+	decode_binary_facet(facet_buf, triangle, normal);
 
-	// Read facet vertices
-	vector<vector3d> t_verts(3);
+	return true;
+}
 
-	for (int i = 0 ; i < 3 ; i++)
+size_t binary_stl_reader::read_facets(triangle3d* triangles, vector3d* normals, size_t max_facets)
+{
+	const size_t FACET_SIZE = mapped_binary_stl_reader::FACET_SIZE;
+	const size_t MAX_FACETS_PER_READ = 4096;
+
+	size_t num_read = 0;
+	vector3d normal;
+
+	while (num_read < max_facets && m_istream.good())
 	{
-		m_istream.read(vector_buf, 12);
-		if (!m_istream.good())
-			return false;
+		const size_t num_to_read = std::min(max_facets - num_read, MAX_FACETS_PER_READ);
+		STL_IMPORT_STAT(if (m_stats && m_facet_buf.capacity() < num_to_read * FACET_SIZE) m_stats->buffer_allocations++);
+		m_facet_buf.resize(num_to_read * FACET_SIZE);
+
+		m_istream.read(m_facet_buf.data(), m_facet_buf.size());
+		m_bytes_read += (size_t) m_istream.gcount();
+		STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += (size_t) m_istream.gcount());
 
-		auto tv_arr = reinterpret_cast<float*>(vector_buf);
-		t_verts[i] = maths::convert<double, float>(vector3f(tv_arr[0], tv_arr[1], tv_arr[2]));
+		// Any trailing partial facet record is thrown away
+		const size_t num_facets = (size_t) m_istream.gcount() / FACET_SIZE;
+
+		for (size_t i = 0 ; i < num_facets ; i++, num_read++)
+			decode_binary_facet(&m_facet_buf[i * FACET_SIZE], triangles[num_read], normals ? normals[num_read] : normal);
 	}
 
-	triangle = triangle3d(t_verts[0], t_verts[1], t_verts[2]);
+	return num_read;
+}
+
+size_t binary_stl_reader::read_facets(triangle_soup& soup, size_t max_facets)
+{
+	const size_t FACET_SIZE = mapped_binary_stl_reader::FACET_SIZE;
+	const size_t MAX_FACETS_PER_READ = 4096;
+
+	const size_t soup_first = soup.size();
+	size_t num_read = 0;
+
+	while (num_read < max_facets && m_istream.good())
+	{
+		const size_t num_to_read = std::min(max_facets - num_read, MAX_FACETS_PER_READ);
+		STL_IMPORT_STAT(if (m_stats && m_facet_buf.capacity() < num_to_read * FACET_SIZE) m_stats->buffer_allocations++);
+		m_facet_buf.resize(num_to_read * FACET_SIZE);
+
+		m_istream.read(m_facet_buf.data(), m_facet_buf.size());
+		m_bytes_read += (size_t) m_istream.gcount();
+		STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += (size_t) m_istream.gcount());
 
-	// Read (and throw away) attribute byte count thing
-	char attrib_count_buf[2];
-	m_istream.read(attrib_count_buf, 2);
+		// Any trailing partial facet record is thrown away
+		const size_t num_facets = (size_t) m_istream.gcount() / FACET_SIZE;
+		soup.resize(soup_first + num_read + num_facets);
 
-	return m_istream.good();
+		for (size_t i = 0 ; i < num_facets ; i++, num_read++)
+			decode_binary_facet(&m_facet_buf[i * FACET_SIZE], soup, soup_first + num_read);
+	}
+
+	return num_read;
 }
 
 bool binary_stl_reader::done() const
@@ -304,59 +548,708 @@ size_t binary_stl_reader::get_file_facet_count()
 	return m_num_facets;
 }
 
+//////////////////////////////
+// mapped_binary_stl_reader
+
+mapped_binary_stl_reader::mapped_binary_stl_reader(const char* data, size_t size)
+: m_data(data)
+, m_size(size)
+, m_cur(data)
+, m_num_facets(0)
+{
+
+}
+
+bool mapped_binary_stl_reader::read_header(string& name)
+{
+	m_cur = m_data;
+
+	if (m_size < HEADER_SIZE)
+	{
+		m_cur = m_data + m_size;
+		return false;
+	}
+
+	name = binary_header_name(m_data);
+	std::memcpy(&m_num_facets, m_data + 80, 4);
+
+	m_cur = m_data + HEADER_SIZE;
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += HEADER_SIZE);
+
+	return true;
+}
+
+bool mapped_binary_stl_reader::read_facet(triangle3d& triangle, vector3d& normal)
+{
+	// Like binary_stl_reader, we keep going until we run out of complete
+	// facet records, regardless of what the header says.
+	const char* end = m_data + m_size;
+	if ((size_t) (end - m_cur) < FACET_SIZE)
+	{
+		m_cur = end;
+		return false;
+	}
+
+	decode_binary_facet(m_cur, triangle, normal);
+	m_cur += FACET_SIZE;
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += FACET_SIZE);
+
+	return true;
+}
+
+size_t mapped_binary_stl_reader::read_facets(triangle3d* triangles, vector3d* normals, size_t max_facets)
+{
+	const char* end = m_data + m_size;
+	const size_t num_facets = std::min(max_facets, (size_t) (end - m_cur) / FACET_SIZE);
+
+	vector3d normal;
+	for (size_t i = 0 ; i < num_facets ; i++, m_cur += FACET_SIZE)
+		decode_binary_facet(m_cur, triangles[i], normals ? normals[i] : normal);
+
+	// Skip any trailing partial facet record
+	if ((size_t) (end - m_cur) < FACET_SIZE)
+		m_cur = end;
+
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += num_facets * FACET_SIZE);
+
+	return num_facets;
+}
+
+size_t mapped_binary_stl_reader::read_facets(triangle_soup& soup, size_t max_facets)
+{
+	const char* end = m_data + m_size;
+	const size_t num_facets = std::min(max_facets, (size_t) (end - m_cur) / FACET_SIZE);
+
+	const size_t soup_first = soup.size();
+	soup.resize(soup_first + num_facets);
+
+	for (size_t i = 0 ; i < num_facets ; i++, m_cur += FACET_SIZE)
+		decode_binary_facet(m_cur, soup, soup_first + i);
+
+	// Skip any trailing partial facet record
+	if ((size_t) (end - m_cur) < FACET_SIZE)
+		m_cur = end;
+
+	STL_IMPORT_STAT(if (m_stats) m_stats->bytes_read += num_facets * FACET_SIZE);
+
+	return num_facets;
+}
+
+size_t mapped_binary_stl_reader::num_facets_available() const
+{
+	return m_size < HEADER_SIZE ? 0 : (m_size - HEADER_SIZE) / FACET_SIZE;
+}
+
+void mapped_binary_stl_reader::decode_facets(size_t first, size_t count, triangle3d* triangles, vector3d* normals) const
+{
+	const char* facet_buf = m_data + HEADER_SIZE + first * FACET_SIZE;
+
+	vector3d normal;
+	for (size_t i = 0 ; i < count ; i++, facet_buf += FACET_SIZE)
+		decode_binary_facet(facet_buf, triangles[i], normals ? normals[i] : normal);
+}
+
+void mapped_binary_stl_reader::decode_facets(size_t first, size_t count, triangle_soup& soup, size_t soup_first) const
+{
+	const char* facet_buf = m_data + HEADER_SIZE + first * FACET_SIZE;
+
+	for (size_t i = 0 ; i < count ; i++, facet_buf += FACET_SIZE)
+		decode_binary_facet(facet_buf, soup, soup_first + i);
+}
+
+bool mapped_binary_stl_reader::done() const
+{
+	return m_cur == m_data + m_size;
+}
+
+size_t mapped_binary_stl_reader::get_file_facet_count()
+{
+	string nop_name;
+	read_header(nop_name);
+
+	return m_num_facets;
+}
+
 ////////////////////////
 // stl_importer
 
-stl_importer::stl_importer(const shared_ptr<istream>& istream)
-: m_istream(istream)
+namespace
+{
+
+// Does the start of an STL look like ASCII, i.e. a "solid" line followed by "facet normal"?
+// (Some binary STLs start with "solid" too.)  data doesn't have to hold whole lines.
+bool looks_like_ascii_stl(const char* data, size_t size)
+{
+	string_view peek(data, size);
+
+	const size_t solid_eol = peek.find('\n');
+	if (solid_eol == string_view::npos)
+		return false;
+
+	// The name might follow "solid" without a space
+	const string_view solid_line = peek.substr(0, solid_eol);
+	const size_t solid_begin = std::min(solid_line.find_first_not_of(" \t"), solid_line.size());
+	if (!ascii_stl_reader::token_is_(solid_line.substr(solid_begin, 5), "solid"))
+		return false;
+
+	// The first non-blank line after that
+	string_view rest = peek.substr(solid_eol + 1);
+	const size_t line_begin = rest.find_first_not_of(" \t\r\n");
+	if (line_begin == string_view::npos)
+		return false;
+
+	string_view facet_line = rest.substr(line_begin, rest.find('\n', line_begin) - line_begin);
+
+	if (!ascii_stl_reader::token_is_(ascii_stl_reader::next_token_(facet_line), "facet") ||
+		!ascii_stl_reader::token_is_(ascii_stl_reader::next_token_(facet_line), "normal"))
+		return false;
+
+	// Text doesn't have NULs, but binary STLs nearly always do (at least in the attribute counts)
+	return std::memchr(data, '\0', size) == nullptr;
+}
+
+// Does size match the facet count in a binary STL header (of which we have header_size bytes)?
+bool has_binary_stl_size(const char* header, size_t header_size, size_t size)
+{
+	if (header_size < mapped_binary_stl_reader::HEADER_SIZE || size < mapped_binary_stl_reader::HEADER_SIZE)
+		return false;
+
+	std::uint32_t num_facets;
+	std::memcpy(&num_facets, header + 80, sizeof(num_facets));
+
+	return size - mapped_binary_stl_reader::HEADER_SIZE == (size_t) num_facets * mapped_binary_stl_reader::FACET_SIZE;
+}
+
+// Finds the start of the line after the first "endfacet" at or after offset from
+size_t find_ascii_chunk_boundary(const char* data, size_t size, size_t from)
+{
+	const string_view ENDFACET("endfacet");
+
+	for (size_t i = from ; i + ENDFACET.size() <= size ; i++)
+	{
+		if ((data[i] | 0x20) == 'e' && ascii_stl_reader::token_is_(string_view(data + i, ENDFACET.size()), ENDFACET))
+		{
+			const size_t tok_end = i + ENDFACET.size();
+			const char* eol = static_cast<const char*>(std::memchr(data + tok_end, '\n', size - tok_end));
+
+			return eol ? (eol - data) + 1 : size;
+		}
+	}
+
+	return size;
+}
+
+};
+
+stl_importer::stl_importer(const shared_ptr<istream>& istream, facet_count_mode count_mode, io_mode mode)
+: m_streaming(count_mode == facet_count_mode::streaming)
+, m_stream_consumed(false)
+, m_istream(istream)
 , m_expected_facet_count(0)
+, m_facets_available(std::numeric_limits<size_t>::max())
 , m_facets_read(0)
+, m_facet_count_exact(false)
+, m_num_threads(1)
+, m_progress_facets(0)
+, m_progress_facets_expected(0)
+, m_progress_bytes(0)
+, m_progress_bytes_total(0)
+, m_cancel_requested(false)
+, m_canceled(false)
 {
+	if (mode == io_mode::read_ahead)
+	{
+		m_source_istream = m_istream;
+		m_read_ahead_streambuf = make_unique<read_ahead_streambuf>(m_source_istream->rdbuf());
+		m_istream = make_shared<std::istream>(m_read_ahead_streambuf.get());
+	}
+
 	m_stl_reader = create_stl_reader_();
-	m_expected_facet_count = m_stl_reader->get_file_facet_count();
+	m_stl_reader->set_stats(&m_stats);
+	init_facet_count_(count_mode);
 }
 
-stl_importer::stl_importer(const string& filename)
-: m_expected_facet_count(0)
+stl_importer::stl_importer(const string& filename, facet_count_mode count_mode, io_mode mode)
+: m_streaming(false)
+, m_stream_consumed(false)
+, m_expected_facet_count(0)
+, m_facets_available(std::numeric_limits<size_t>::max())
 , m_facets_read(0)
+, m_facet_count_exact(false)
+, m_num_threads(1)
+, m_progress_facets(0)
+, m_progress_facets_expected(0)
+, m_progress_bytes(0)
+, m_progress_bytes_total(0)
+, m_cancel_requested(false)
+, m_canceled(false)
 {
-	auto stl_ifstream = make_shared<ifstream>();
+	// Binary STLs are decoded straight out of a mapping of the file.
+	// If the file can't be mapped (e.g. it's a FIFO) we just fall back to the stream.
+	try
+	{
+		m_mapped_file = make_unique<mapped_file>(filename);
+	}
+	catch (std::runtime_error&)
+	{
+		m_mapped_file.reset();
+	}
 
-	stl_ifstream->open(filename, std::fstream::binary);
+	if (mode == io_mode::read_ahead && !m_mapped_file)
+	{
+		m_read_ahead_streambuf = make_unique<read_ahead_streambuf>(filename);
+		m_istream = make_shared<std::istream>(m_read_ahead_streambuf.get());
+	}
+	else
+	{
+		auto stl_ifstream = make_shared<ifstream>();
+
+		stl_ifstream->open(filename, std::fstream::binary);
 
-	if (!stl_ifstream->is_open())
-		throw std::runtime_error("Error opening file");
+		if (!stl_ifstream->is_open())
+			throw std::runtime_error("Error opening file");
+
+		m_istream = stl_ifstream;
+
+		// A mapped file might not need the stream at all (binary, or ASCII split between threads),
+		// so don't start reading it ahead just for format detection and counting
+		if (mode == io_mode::read_ahead)
+			m_read_ahead_filename = filename;
+	}
 
-	m_istream = stl_ifstream;
+	// Mapped files can be read as often as we like, otherwise it might be a FIFO
+	m_streaming = count_mode == facet_count_mode::streaming && !m_mapped_file;
 
 	m_stl_reader = create_stl_reader_();
-	m_expected_facet_count = m_stl_reader->get_file_facet_count();
+	m_stl_reader->set_stats(&m_stats);
+	init_facet_count_(count_mode);
 }
 
-unique_ptr<stl_reader_interface> stl_importer::create_stl_reader_()
+void stl_importer::init_facet_count_(facet_count_mode count_mode)
+{
+	STL_IMPORT_TIMER(m_stats.count_seconds);
+
+	// create_streaming_reader_() has already got what it can from the peek
+	if (m_streaming)
+		return;
+
+	// Binary STLs have the facet count in the header, so there's no point in estimating
+	if (count_mode == facet_count_mode::estimate && dynamic_cast<ascii_stl_reader*>(m_stl_reader.get()))
+	{
+		m_expected_facet_count = input_size_() / ASCII_BYTES_PER_FACET;
+		m_facet_count_exact = false;
+	}
+	else
+	{
+		m_expected_facet_count = m_stl_reader->get_file_facet_count();
+		m_facet_count_exact = true;
+	}
+
+	// ASCII counts come from the data itself, binary header counts could be any old thing
+	if (!is_ascii())
+	{
+		const size_t size = input_size_();
+		m_facets_available = size < mapped_binary_stl_reader::HEADER_SIZE ? 0 :
+			(size - mapped_binary_stl_reader::HEADER_SIZE) / mapped_binary_stl_reader::FACET_SIZE;
+	}
+}
+
+size_t stl_importer::input_size_()
 {
-	// Peek at the first line of the file
+	if (m_mapped_file)
+		return m_mapped_file->size();
+
+	if (m_streaming)
+		return 0;	// no telling
+
+	m_istream->clear();
+	m_istream->seekg(0, std::ios::end);
+	const streamoff size = m_istream->tellg();
 	m_istream->seekg(0);
 
-	// Rewind the stream when we're done
-	finally f([this]() { m_istream->seekg(0); });
+	return size > 0 ? (size_t) size : 0;
+}
+
+void stl_importer::begin_import_()
+{
+	if (!m_stl_reader)
+	{
+		auto stl_reader = create_stl_reader_();
+		if (stl_reader)
+			m_stl_reader = std::move(stl_reader);
+		else
+			throw std::runtime_error("Error creating STL reader!");
+
+		m_stl_reader->set_stats(&m_stats);
+	}
+
+	if (m_streaming)
+	{
+		// There's no going back
+		if (m_stream_consumed)
+			throw std::runtime_error("A streaming STL can only be imported once");
+
+		m_stream_consumed = true;
+	}
+	else
+	{
+		// Seek to beginning of file, reset istream
+		m_istream->clear();
+		m_istream->seekg(0);
+	}
+
+	m_facets_read = 0;
+
+	// A cancel() that came in before we started still applies to this import
+	m_canceled.store(false);
+	m_progress_facets.store(0);
+	m_progress_bytes.store(0);
+	m_progress_facets_expected.store(m_expected_facet_count);
+	m_progress_bytes_total.store(input_size_());
+}
+
+import_progress stl_importer::progress() const
+{
+	import_progress progress;
+	progress.facets_read = m_progress_facets.load(std::memory_order_relaxed);
+	progress.facets_expected = m_progress_facets_expected.load(std::memory_order_relaxed);
+	progress.bytes_read = m_progress_bytes.load(std::memory_order_relaxed);
+	progress.bytes_total = m_progress_bytes_total.load(std::memory_order_relaxed);
+
+	return progress;
+}
+
+std::future<vector<triangle3d>> stl_importer::import_async()
+{
+	return std::async(std::launch::async, [this]()
+	{
+		vector<triangle3d> triangles;
+		triangles.reserve(num_facets_to_reserve());
+		import(std::back_inserter(triangles));
+
+		return triangles;
+	});
+}
+
+unique_ptr<stl_reader_interface> stl_importer::create_streaming_reader_()
+{
+	// Read the first few KB to see what we've got...
+	vector<char> peek(FORMAT_PEEK_SIZE);
+	m_istream->read(peek.data(), (streamsize) peek.size());
+	peek.resize((size_t) m_istream->gcount());
+
+	const bool is_ascii = looks_like_ascii_stl(peek.data(), peek.size());
+
+	// Binary STLs have the facet count right there in the header
+	m_facet_count_exact = !is_ascii && peek.size() >= mapped_binary_stl_reader::HEADER_SIZE;
+	if (m_facet_count_exact)
+	{
+		std::uint32_t num_facets;
+		std::memcpy(&num_facets, peek.data() + 80, sizeof(num_facets));
+		m_expected_facet_count = num_facets;
+
+		// We can't check the count against the size of a stream
+		m_facets_available = MAX_UNCHECKED_RESERVE;
+	}
+
+	// ...and then put it back in front of the rest of the stream
+	if (!m_source_istream)
+		m_source_istream = m_istream;
+
+	m_prefix_streambuf = make_unique<prefix_streambuf>(std::move(peek), m_istream->rdbuf());
+	m_istream = make_shared<istream>(m_prefix_streambuf.get());
+
+	if (is_ascii)
+		return make_unique<ascii_stl_reader>(*m_istream);
+
+	return make_unique<binary_stl_reader>(*m_istream);
+}
 
-	string line;
-	getline_crlf_lf(*m_istream, line);
-	ascii_stl_reader::prep_line_(line);
+unique_ptr<stl_reader_interface> stl_importer::create_stl_reader_()
+{
+	STL_IMPORT_TIMER(m_stats.detect_seconds);
+
+	if (m_streaming)
+		return create_streaming_reader_();
+
+	// The size and the first few KB are all we need to look at
+	const size_t size = input_size_();
 
-	string solid_substr(line.begin(), line.begin() + 5);
-	if (solid_substr == "solid")
+	vector<char> peek_buf;
+	const char* peek = nullptr;
+	size_t peek_size = 0;
+
+	if (m_mapped_file)
+	{
+		peek = m_mapped_file->data();
+		peek_size = std::min(size, FORMAT_PEEK_SIZE);
+	}
+	else
 	{
-		// Because some assholes think it's OK to start a binary STL with "solid"...
-		getline_crlf_lf(*m_istream, line);
+		peek_buf.resize(FORMAT_PEEK_SIZE);
 
-		ascii_stl_reader::prep_line_(line);
-		auto tokens = ascii_stl_reader::tokenize_line_(line);
+		m_istream->clear();
+		m_istream->seekg(0);
+		m_istream->read(peek_buf.data(), (streamsize) peek_buf.size());
 
-		if (tokens.size() > 2 && tokens[0] == "facet" && tokens[1] == "normal")
-			return make_unique<ascii_stl_reader>(*m_istream);
+		peek = peek_buf.data();
+		peek_size = (size_t) m_istream->gcount();
+
+		m_istream->clear();
+		m_istream->seekg(0);
 	}
 
+	// Because some assholes think it's OK to start a binary STL with "solid", the size is the
+	// better test.  ASCII STLs would need a facet count of hundreds of millions to fit.
+	if (!has_binary_stl_size(peek, peek_size, size) && looks_like_ascii_stl(peek, peek_size))
+		return make_unique<ascii_stl_reader>(*m_istream);
+
+	if (m_mapped_file)
+		return make_unique<mapped_binary_stl_reader>(m_mapped_file->data(), m_mapped_file->size());
+
 	return make_unique<binary_stl_reader>(*m_istream);
 }
+
+void stl_importer::begin_read_ahead_()
+{
+	if (m_read_ahead_filename.empty() || !dynamic_cast<ascii_stl_reader*>(m_stl_reader.get()))
+		return;
+
+	// Switch the parser over to a stream that reads ahead, from the start of the file
+	m_read_ahead_streambuf = make_unique<read_ahead_streambuf>(m_read_ahead_filename);
+	m_read_ahead_filename.clear();
+
+	m_stl_reader.reset();
+	m_istream = make_shared<std::istream>(m_read_ahead_streambuf.get());
+
+	m_stl_reader = make_unique<ascii_stl_reader>(*m_istream);
+	m_stl_reader->set_stats(&m_stats);
+}
+
+void stl_importer::import_parallel_(vector<triangle3d>& triangles)
+{
+	STL_IMPORT_TIMER(m_stats.parse_seconds);
+
+	const bool is_ascii = dynamic_cast<ascii_stl_reader*>(m_stl_reader.get()) != nullptr;
+
+	if (m_mapped_file)
+	{
+		if (is_ascii)
+			import_parallel_ascii_(m_mapped_file->data(), m_mapped_file->size(), triangles);
+		else
+			import_parallel_binary_(m_mapped_file->data(), m_mapped_file->size(), triangles);
+	}
+	else
+	{
+		// We need the whole thing in memory to split it up.  Asking for a byte more than the size
+		// (which also rewinds the stream) reads it all in one go, otherwise it's a stream of
+		// unknown size that we read a bit at a time.
+		const size_t size = input_size_();
+
+		string stl_str;
+		STL_IMPORT_STAT(m_stats.buffer_allocations++);
+
+		for (size_t read_size = size + 1 ; m_istream->good() ; read_size = MIN_PARALLEL_CHUNK_SIZE)
+		{
+			const size_t num_buffered = stl_str.size();
+			stl_str.resize(num_buffered + read_size);
+			m_istream->read(&stl_str[num_buffered], (streamsize) read_size);
+			stl_str.resize(num_buffered + (size_t) m_istream->gcount());
+		}
+
+		check_read_error_();
+
+		if (is_ascii)
+			import_parallel_ascii_(stl_str.data(), stl_str.size(), triangles);
+		else
+			import_parallel_binary_(stl_str.data(), stl_str.size(), triangles);
+	}
+}
+
+void stl_importer::import_parallel_ascii_(const char* data, size_t size, vector<triangle3d>& triangles)
+{
+	const unsigned num_threads = resolve_num_threads(m_num_threads);
+
+	// Use a few more chunks than threads, so that the work balances out
+	const size_t num_chunks = std::max<size_t>(1, std::min<size_t>(num_threads * 4, size / MIN_PARALLEL_CHUNK_SIZE));
+
+	// Each chunk starts on the line after an "endfacet", so that chunks only contain whole facets
+	vector<size_t> chunk_begin(1, 0);
+	for (size_t i = 1 ; i < num_chunks ; i++)
+		chunk_begin.push_back(find_ascii_chunk_boundary(data, size, std::max(i * (size / num_chunks), chunk_begin.back())));
+	chunk_begin.push_back(size);
+
+	vector<vector<triangle3d>> chunk_triangles(num_chunks);
+	bool got_header = false;
+
+	// Each chunk counts its own lines, so that the threads don't share stats
+	STL_IMPORT_STAT(vector<import_stats> chunk_stats(num_chunks));
+
+	parallel_for(num_chunks, num_threads, [&](size_t i)
+	{
+		ascii_stl_reader reader(data + chunk_begin[i], chunk_begin[i + 1] - chunk_begin[i]);
+		STL_IMPORT_STAT(reader.set_stats(&chunk_stats[i]));
+
+		// Only the first chunk has the "solid" line
+		if (i == 0 && !(got_header = reader.read_header(m_stl_name)))
+			return;
+
+		vector<triangle3d>& chunk = chunk_triangles[i];
+		while (!reader.done() && !cancel_requested_())
+		{
+			const size_t num_chunk_facets = chunk.size();
+			chunk.resize(num_chunk_facets + IMPORT_BATCH_SIZE);
+			chunk.resize(num_chunk_facets + reader.read_facets(&chunk[num_chunk_facets], nullptr, IMPORT_BATCH_SIZE));
+
+			m_progress_facets.fetch_add(chunk.size() - num_chunk_facets, std::memory_order_relaxed);
+		}
+
+		m_progress_bytes.fetch_add(reader.bytes_read(), std::memory_order_relaxed);
+	});
+
+	triangles.clear();
+
+	STL_IMPORT_STAT(m_stats.bytes_read += size);
+	STL_IMPORT_STAT(m_stats.buffer_allocations += num_chunks + 1);
+	STL_IMPORT_STAT(for (const auto& stats : chunk_stats) m_stats.lines_skipped += stats.lines_skipped);
+
+	if (cancel_requested_())
+		return;
+
+	if (!got_header)
+		throw std::runtime_error("Error reading STL header");
+
+	// Stitch the chunks back together in file order
+	size_t num_facets = 0;
+	for (const auto& chunk : chunk_triangles)
+		num_facets += chunk.size();
+
+	STL_IMPORT_STAT(m_stats.facets_parsed += num_facets);
+
+	triangles.reserve(num_facets);
+	for (const auto& chunk : chunk_triangles)
+		triangles.insert(triangles.end(), chunk.begin(), chunk.end());
+}
+
+void stl_importer::import_parallel_binary_(const char* data, size_t size, vector<triangle3d>& triangles)
+{
+	mapped_binary_stl_reader reader(data, size);
+
+	triangles.clear();
+
+	if (!reader.read_header(m_stl_name))
+		throw std::runtime_error("Error reading STL header");
+
+	// Facet records are a fixed size, so each thread can decode its share
+	// straight into its own slice of the output.
+	const size_t num_facets = reader.num_facets_available();
+	triangles.resize(num_facets);
+
+	STL_IMPORT_STAT(m_stats.buffer_allocations++);
+	STL_IMPORT_STAT(m_stats.bytes_read += size);
+
+	const unsigned num_threads = resolve_num_threads(m_num_threads);
+	const size_t facets_per_thread = (num_facets + num_threads - 1) / num_threads;
+
+	m_progress_bytes.store(mapped_binary_stl_reader::HEADER_SIZE);
+
+	parallel_for(num_threads, num_threads, [&](size_t i)
+	{
+		const size_t first = std::min(i * facets_per_thread, num_facets);
+		const size_t count = std::min(facets_per_thread, num_facets - first);
+
+		// Decode in batches, so that we can report progress and stop if we're canceled
+		for (size_t batch = first ; batch < first + count && !cancel_requested_() ; batch += IMPORT_BATCH_SIZE)
+		{
+			const size_t batch_count = std::min(IMPORT_BATCH_SIZE, first + count - batch);
+			reader.decode_facets(batch, batch_count, triangles.data() + batch, nullptr);
+
+			m_progress_facets.fetch_add(batch_count, std::memory_order_relaxed);
+			m_progress_bytes.fetch_add(batch_count * mapped_binary_stl_reader::FACET_SIZE, std::memory_order_relaxed);
+		}
+	});
+
+	if (cancel_requested_())
+		triangles.clear();
+	else
+		STL_IMPORT_STAT(m_stats.facets_parsed += num_facets);
+}
+
+void stl_importer::import_soup(triangle_soup& soup)
+{
+	STL_IMPORT_TIMER(m_stats.total_seconds);
+
+	begin_import_();
+	begin_read_ahead_();
+	soup.clear();
+
+	if (!m_stl_reader->read_header(m_stl_name))
+		throw std::runtime_error("Error reading STL header");
+
+	soup.name() = m_stl_name;
+
+	const mapped_binary_stl_reader* mapped_reader = dynamic_cast<mapped_binary_stl_reader*>(m_stl_reader.get());
+	const unsigned num_threads = resolve_num_threads(m_num_threads);
+
+	if (mapped_reader && num_threads > 1)
+	{
+		// Same as import_parallel_binary_(), but straight into the soup
+		const size_t num_facets = mapped_reader->num_facets_available();
+		soup.resize(num_facets);
+
+		const size_t facets_per_thread = (num_facets + num_threads - 1) / num_threads;
+
+		m_progress_bytes.store(mapped_binary_stl_reader::HEADER_SIZE);
+
+		{
+			STL_IMPORT_TIMER(m_stats.parse_seconds);
+
+			parallel_for(num_threads, num_threads, [&](size_t i)
+			{
+				const size_t first = std::min(i * facets_per_thread, num_facets);
+				const size_t count = std::min(facets_per_thread, num_facets - first);
+
+				for (size_t batch = first ; batch < first + count && !cancel_requested_() ; batch += IMPORT_BATCH_SIZE)
+				{
+					const size_t batch_count = std::min(IMPORT_BATCH_SIZE, first + count - batch);
+					mapped_reader->decode_facets(batch, batch_count, soup, batch);
+
+					m_progress_facets.fetch_add(batch_count, std::memory_order_relaxed);
+					m_progress_bytes.fetch_add(batch_count * mapped_binary_stl_reader::FACET_SIZE, std::memory_order_relaxed);
+				}
+			});
+		}
+
+		if (cancel_requested_())
+		{
+			soup.clear();
+			return;
+		}
+
+		m_facets_read = num_facets;
+
+		STL_IMPORT_STAT(m_stats.facets_parsed += num_facets);
+		STL_IMPORT_STAT(m_stats.bytes_read += num_facets * mapped_binary_stl_reader::FACET_SIZE);
+	}
+	else
+	{
+		soup.reserve(num_facets_to_reserve());
+		STL_IMPORT_STAT(m_stats.buffer_allocations++);
+
+		while (!m_stl_reader->done())
+		{
+			if (cancel_requested_())
+				return;
+
+			STL_IMPORT_TIMER(m_stats.parse_seconds);
+
+			const size_t num_read = m_stl_reader->read_facets(soup, IMPORT_BATCH_SIZE);
+			m_facets_read += num_read;
+			STL_IMPORT_STAT(m_stats.facets_parsed += num_read);
+
+			publish_progress_();
+		}
+	}
+
+	import_finished_();
+}
@@ -3,52 +3,116 @@
 
 #include <memory>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include <stdexcept>
 
 #include "geom.h"
+#include "triangle_soup.h"
+#include "mapped_file.h"
+#include "prefix_streambuf.h"
+#include "read_ahead_streambuf.h"
+#include "parallel.h"
+#include "instrumentation.h"
 
 namespace stl_util
 {
 
 class stl_reader_interface
 {
+protected:
+	import_stats*	m_stats = nullptr;	// only updated in instrumented builds
+
 public:
 	virtual bool read_header(std::string& name) = 0;
 	virtual bool read_facet(maths::triangle3d& triangle, maths::vector3d& normal) = 0;
 	virtual bool done() const = 0;
 
+	/** Reads up to max_facets facets into the caller-provided triangles (and normals) arrays.
+	 *  normals may be null if the facet normals aren't needed.  Facets that can't be read
+	 *  are skipped, so fewer than max_facets facets are returned only when the reader is done().
+	 *  @return the number of facets written to triangles.
+	 */
+	virtual size_t read_facets(maths::triangle3d* triangles, maths::vector3d* normals, size_t max_facets) = 0;
+
+	/** Like read_facets() above, but appends the facets to soup.
+	 *  The default converts from triangles, binary readers copy their facet records straight in.
+	 */
+	virtual size_t read_facets(triangle_soup& soup, size_t max_facets);
+
 	virtual size_t get_file_facet_count() = 0;
 
+	/** How far into the input the reader has got, in bytes (0 if the reader doesn't keep track) */
+	virtual size_t bytes_read() const { return 0; }
+
+	/** Where to count bytes, lines and buffers, if built with STL_IMPORT_INSTRUMENTATION (may be null) */
+	void set_stats(import_stats* stats) { m_stats = stats; }
+
 	virtual ~stl_reader_interface() { }
 };
 
+/** Reads an ASCII STL.
+ *  The input is pulled into a large buffer and parsed in place, so no
+ *  per-line or per-token strings are created.  Keywords are matched
+ *  case-insensitively.
+ */
 class ascii_stl_reader : public stl_reader_interface
 {
 private:
-	std::istream&	m_istream;
-	bool			m_done;
+	std::istream*		m_istream;	// null when reading from memory
+	std::vector<char>	m_buffer;	// data read from m_istream
+	const char*			m_begin;	// start of the in-memory data
+	const char*			m_pos;		// current parse position
+	const char*			m_end;		// end of the available data
+	size_t				m_bytes_discarded;	// read from m_istream and parsed before the start of m_buffer
+	size_t				m_lines_read;		// non-blank lines, only counted in instrumented builds
+	bool				m_done;
+
+	static const size_t	READ_BLOCK_SIZE = 1 << 20;
 
 public:
 	static void prep_line_(std::string& line);	// converts tabs to spaces and makes all characters lowercase
 	static std::vector<std::string> tokenize_line_(const std::string& line);
 
+	/** Splits the next space or tab delimited token off of the front of line */
+	static std::string_view next_token_(std::string_view& line);
+
+	/** Case-insensitive comparison of token to a lowercase keyword */
+	static bool token_is_(std::string_view token, std::string_view keyword);
+
+	/** Parses a floating point number from the given token */
+	static bool parse_double_(std::string_view token, double& d);
+
 private:
-	std::string get_next_line();
+	bool fill_buffer_();				// reads more data from m_istream, keeping anything we haven't parsed yet
+	std::string_view get_next_line_();	// next non-blank line, trimmed.  Empty at the end of the input.
+	void rewind_();
 
 public:
 	ascii_stl_reader(std::istream& istream);
+	ascii_stl_reader(const char* data, size_t size);	// reads from memory, which must outlive the reader
 
 	bool read_header(std::string& name) override;
 	bool read_facet(maths::triangle3d& triangle, maths::vector3d& normal) override;
 	bool done() const override;
 
+	using stl_reader_interface::read_facets;
+	size_t read_facets(maths::triangle3d* triangles, maths::vector3d* normals, size_t max_facets) override;
+
 	size_t get_file_facet_count() override;
+	size_t bytes_read() const override;
 };
 
 class binary_stl_reader : public stl_reader_interface
 {
 private:
-	std::istream&	m_istream;
-	std::uint32_t	m_num_facets;
+	std::istream&		m_istream;
+	std::uint32_t		m_num_facets;
+	std::vector<char>	m_facet_buf;	// scratch space for read_facets()
+	size_t				m_bytes_read;
 
 public:
 	binary_stl_reader(std::istream& istream);	// throws if stream is not binary
@@ -57,7 +121,50 @@ public:
 	bool read_facet(maths::triangle3d& triangle, maths::vector3d& normal) override;
 	bool done() const override;
 
+	size_t read_facets(maths::triangle3d* triangles, maths::vector3d* normals, size_t max_facets) override;
+	size_t read_facets(triangle_soup& soup, size_t max_facets) override;
+
+	size_t get_file_facet_count() override;
+	size_t bytes_read() const override { return m_bytes_read; }
+};
+
+/** Reads a binary STL directly out of a block of memory (typically a mapped_file),
+ *  rather than pulling each facet through an std::istream.
+ *  The memory is not owned by the reader and must outlive it.
+ */
+class mapped_binary_stl_reader : public stl_reader_interface
+{
+private:
+	const char*		m_data;
+	size_t			m_size;
+	const char*		m_cur;
+	std::uint32_t	m_num_facets;
+
+public:
+	static const size_t HEADER_SIZE = 84;	// 80 byte header + 4 byte facet count
+	static const size_t FACET_SIZE = 50;	// normal, 3 vertices, 2 byte attribute count
+
+	mapped_binary_stl_reader(const char* data, size_t size);
+
+	bool read_header(std::string& name) override;
+	bool read_facet(maths::triangle3d& triangle, maths::vector3d& normal) override;
+	bool done() const override;
+
+	size_t read_facets(maths::triangle3d* triangles, maths::vector3d* normals, size_t max_facets) override;
+	size_t read_facets(triangle_soup& soup, size_t max_facets) override;
+
+	/** The number of complete facet records following the header (which may not match the header's count) */
+	size_t num_facets_available() const;
+
+	/** Decodes count facets starting at facet index first, independently of the read position,
+	 *  so disjoint ranges can be decoded concurrently.  The range must be within num_facets_available().
+	 *  normals may be null.
+	 */
+	void decode_facets(size_t first, size_t count, maths::triangle3d* triangles, maths::vector3d* normals) const;
+	void decode_facets(size_t first, size_t count, triangle_soup& soup, size_t soup_first) const;
+
 	size_t get_file_facet_count() override;
+	size_t bytes_read() const override { return m_cur - m_data; }
 };
 
 class import_cancel_exception : public std::exception
@@ -69,69 +176,354 @@ public:
 	}
 };
 
+/** A snapshot of how far along an import is */
+struct import_progress
+{
+	size_t	facets_read = 0;
+	size_t	facets_expected = 0;	// may be an estimate, see stl_importer::facet_count_is_exact()
+	size_t	bytes_read = 0;
+	size_t	bytes_total = 0;		// 0 if the size of the input isn't known
+
+	/** How much of the import is done, from 0 to 1 */
+	double fraction() const
+	{
+		if (bytes_total > 0)
+			return std::min(1.0, (double) bytes_read / (double) bytes_total);
+
+		return facets_expected > 0 ? std::min(1.0, (double) facets_read / (double) facets_expected) : 0.0;
+	}
+};
+
+/** How stl_importer finds out the number of facets to expect before import() */
+enum class facet_count_mode
+{
+	exact,		/**< Count the facets up front.  For ASCII STLs this reads the whole file an extra time. */
+	estimate,	/**< Estimate the count of ASCII STLs from the file size.  The exact count is known after import(). */
+	streaming	/**< Read the input once, front to back, without seeking, for pipes and other streams that can't be
+					 rewound.  The format is detected from the first few KB, and only one import can be done.
+					 Binary STL counts come from the header, ASCII STL counts aren't known until after import(). */
+};
+
+/** How stl_importer reads from its stream.  Binary STLs that can be memory mapped are decoded
+ *  straight out of the mapping either way, and memory mapped ASCII STLs are only read ahead
+ *  when they're parsed on a single thread.
+ */
+enum class io_mode
+{
+	direct,		/**< Read on the importing thread, whenever the parser needs more */
+	read_ahead	/**< Read large blocks ahead on a separate I/O thread, so that reading and parsing overlap */
+};
+
 class stl_importer
 {
 private:
+	// In streaming mode, m_istream reads the bytes we peeked at followed by the rest of m_source_istream.
+	// In read ahead mode, m_istream reads from m_read_ahead_streambuf, which reads the file or m_source_istream.
+	std::shared_ptr<std::istream>			m_source_istream;
+	std::unique_ptr<read_ahead_streambuf>	m_read_ahead_streambuf;
+	std::string								m_read_ahead_filename;	// mapped, so read ahead only once the stream reader needs it
+	std::unique_ptr<prefix_streambuf>		m_prefix_streambuf;
+	bool									m_streaming;
+	bool									m_stream_consumed;	// a streaming import has been done
+
 	std::shared_ptr<std::istream>			m_istream;
+	std::unique_ptr<mapped_file>			m_mapped_file;	// only when importing from a file
 	std::unique_ptr<stl_reader_interface>	m_stl_reader;
 
 	std::string								m_stl_name;
 
 	size_t									m_expected_facet_count;
+	size_t									m_facets_available;	// the most facets the input could hold, as far as we know
 	size_t									m_facets_read;
+	bool									m_facet_count_exact;
+
+	unsigned								m_num_threads;
+
+	import_stats							m_stats;
+
+	// Progress and cancellation, which other threads can look at while we import
+	std::atomic<size_t>						m_progress_facets;
+	std::atomic<size_t>						m_progress_facets_expected;
+	std::atomic<size_t>						m_progress_bytes;
+	std::atomic<size_t>						m_progress_bytes_total;
+	std::atomic<bool>						m_cancel_requested;
+	std::atomic<bool>						m_canceled;
+
+	static constexpr size_t					IMPORT_BATCH_SIZE = 4096;	// facets per read_facets() call
+	static const size_t						MIN_PARALLEL_CHUNK_SIZE = 1 << 16;
+	static const size_t						ASCII_BYTES_PER_FACET = 220;	// rough average, for estimating facet counts
+	static constexpr size_t					FORMAT_PEEK_SIZE = 4096;		// read from the start of the input to detect the format
+	static constexpr size_t					MAX_UNCHECKED_RESERVE = 1 << 16;	// facets to reserve for a binary stream of unknown size
 
 	std::unique_ptr<stl_reader_interface>	create_stl_reader_();
+	std::unique_ptr<stl_reader_interface>	create_streaming_reader_();
+	void									init_facet_count_(facet_count_mode count_mode);
+	void									begin_import_();	// rewinds the input for a new import
+	void									begin_read_ahead_();	// before reading a mapped file through the stream
+	size_t									input_size_();
+
+	/** A failed read looks just like the end of the input to the parser, so check for one
+	 *  once the input has been read.  Throws std::runtime_error if there was one.
+	 */
+	void check_read_error_() const
+	{
+		if (m_read_ahead_streambuf && m_read_ahead_streambuf->error())
+			throw std::runtime_error("Error reading STL");
+	}
+
+	/** Called when import() has read the whole file.  The facet count is exact from here on. */
+	void import_finished_()
+	{
+		check_read_error_();
+
+		m_expected_facet_count = m_facets_read;
+		m_facet_count_exact = true;
+
+		// The whole input has been read, however it was split up
+		const size_t bytes_total = m_progress_bytes_total.load(std::memory_order_relaxed);
+		m_progress_bytes.store(bytes_total > 0 ? bytes_total : m_stl_reader->bytes_read(), std::memory_order_relaxed);
+		m_progress_facets.store(m_facets_read, std::memory_order_relaxed);
+		m_progress_facets_expected.store(m_expected_facet_count, std::memory_order_relaxed);
+	}
+
+	/** Updates progress() after a batch of facets has been read on the importing thread */
+	void publish_progress_()
+	{
+		m_progress_facets.store(m_facets_read, std::memory_order_relaxed);
+		m_progress_bytes.store(m_stl_reader->bytes_read(), std::memory_order_relaxed);
+	}
+
+	/** Reads the next batch of facets into triangles (which is already sized for a batch) */
+	size_t read_batch_(std::vector<maths::triangle3d>& triangles)
+	{
+		STL_IMPORT_TIMER(m_stats.parse_seconds);
+
+		const size_t num_read = m_stl_reader->read_facets(triangles.data(), nullptr, triangles.size());
+		STL_IMPORT_STAT(m_stats.facets_parsed += num_read);
+
+		return num_read;
+	}
+
+	/** Checked between batches.  Once cancel() has been called, this stays true until the next import starts. */
+	bool cancel_requested_()
+	{
+		if (m_cancel_requested.load(std::memory_order_relaxed) && m_cancel_requested.exchange(false))
+			m_canceled.store(true);
+
+		return m_canceled.load(std::memory_order_relaxed);
+	}
+
+	/** Reads the whole STL using m_num_threads threads.
+	 *  Throws std::runtime_error if the STL header can't be read.
+	 */
+	void import_parallel_(std::vector<maths::triangle3d>& triangles);
+	void import_parallel_ascii_(const char* data, size_t size, std::vector<maths::triangle3d>& triangles);
+	void import_parallel_binary_(const char* data, size_t size, std::vector<maths::triangle3d>& triangles);
 
 public:
-	stl_importer(const std::shared_ptr<std::istream>& istream);
-	stl_importer(const std::string& filename);
+	stl_importer(const std::shared_ptr<std::istream>& istream, facet_count_mode count_mode = facet_count_mode::exact,
+		io_mode mode = io_mode::direct);
+	stl_importer(const std::string& filename, facet_count_mode count_mode = facet_count_mode::exact,
+		io_mode mode = io_mode::direct);
 
 	const std::string& name() const { return m_stl_name; }
 
-	/** The number of facets that we expect to read from the input STL */
+	/** Is the input an ASCII STL (rather than binary)? */
+	bool is_ascii() const { return dynamic_cast<const ascii_stl_reader*>(m_stl_reader.get()) != nullptr; }
+
+	/** The number of facets that we expect to read from the input STL.
+	 *  This is an estimate if the importer was created with facet_count_mode::estimate, until
+	 *  import() finishes, after which it is the number of facets that were actually read.
+	 */
 	size_t num_facets_expected() const { return m_expected_facet_count; }
 
+	/** num_facets_expected(), limited to what the input could actually hold, for sizing allocations
+	 *  up front.  The count in a binary STL header can be anything, the facets are read up to the end
+	 *  of the file regardless.
+	 */
+	size_t num_facets_to_reserve() const { return std::min(m_expected_facet_count, m_facets_available); }
+
+	/** Is num_facets_expected() exact, rather than an estimate? */
+	bool facet_count_is_exact() const { return m_facet_count_exact; }
+
 	/** The number of facets that we actually read from the input STL */
 	size_t num_facets_read() const { return m_facets_read; }
 
+	/** Sets the number of threads that import() uses to parse the STL (0 means one per core).
+	 *  With more than one thread, ASCII STLs are split into chunks on facet boundaries which
+	 *  are parsed concurrently, binary STLs are split into equal runs of facet records, and
+	 *  the whole file is read before the facets are output (in file order).
+	 */
+	void set_num_threads(unsigned num_threads) { m_num_threads = num_threads; }
+	unsigned num_threads() const { return m_num_threads; }
+
+	/** Where the time went, for all of the imports so far (including detecting the format and
+	 *  counting the facets when the importer was created).  Always zero unless the library was
+	 *  built with STL_IMPORT_INSTRUMENTATION, see instrumentation.h.
+	 */
+	const import_stats& stats() const { return m_stats; }
+	void reset_stats() { m_stats = import_stats(); }
+
+	/** How far along the current (or last) import is.
+	 *  This can be called from any thread while an import is running.  It is updated
+	 *  once per batch of facets, and is lock-free.
+	 */
+	import_progress progress() const;
+
+	/** Asks the import that is running (on another thread) to stop.  It stops after the
+	 *  batch of facets that it's working on, without outputting anything more, and
+	 *  canceled() becomes true.  If no import is running, the next one stops right away.
+	 */
+	void cancel() { m_cancel_requested.store(true); }
+
+	/** Was the last import stopped by cancel() before it finished? */
+	bool canceled() const { return m_canceled.load(); }
+
+	/** Runs import(oi) on a new thread, returning a future that is ready when it is done.
+	 *  Use progress() and cancel() to keep track of the import while it runs.
+	 *  The importer, and whatever oi outputs to, must outlive the import.
+	 *  Any exception thrown by import() is rethrown by the future's get().
+	 */
+	template <typename OutputIterator>
+	std::future<void> import_async(OutputIterator oi)
+	{
+		return std::async(std::launch::async, [this, oi]() { import(oi); });
+	}
+
+	/** Runs import() on a new thread, collecting the facets into a vector */
+	std::future<std::vector<maths::triangle3d>> import_async();
+
+	/** Imports the whole STL into soup, replacing its contents.
+	 *  Unlike import(), binary facet records are copied into the soup without
+	 *  converting them to double precision, along with their attribute byte counts
+	 *  if the soup stores them.  With more than one thread, memory-mapped binary
+	 *  STLs are decoded concurrently; anything else is read on the calling thread.
+	 *  Throws std::runtime_error if the STL header can't be read.
+	 */
+	void import_soup(triangle_soup& soup);
+
+	/** Imports the whole STL, writing each facet to oi as a triangle3d.
+	 *  Throws std::runtime_error if the STL header can't be read, however many threads are used.
+	 */
 	template <typename OutputIterator>
 	void import(OutputIterator oi)
 	{
-		if (!m_stl_reader)
-		{
-			auto stl_reader = create_stl_reader_();
-			if (stl_reader)
-				m_stl_reader = std::move(stl_reader);
-			else
-				throw std::runtime_error("Error creating STL reader!");
-		}
+		STL_IMPORT_TIMER(m_stats.total_seconds);
 
-		// Seek to beginning of file, reset istream
-		m_istream->seekg(0);
-		m_facets_read = 0;
+		begin_import_();
 
-		if (!m_stl_reader->read_header(m_stl_name))
-			return;	// TODO - throw exception
+		std::vector<maths::triangle3d> triangles;
 
-		while (!m_stl_reader->done())
+		if (resolve_num_threads(m_num_threads) > 1)
 		{
-			maths::triangle3d triangle;
-			maths::vector3d normal;
+			import_parallel_(triangles);
 
-			if (m_stl_reader->read_facet(triangle, normal))
+			if (cancel_requested_())
+				return;
+
+			try
 			{
-				try
+				STL_IMPORT_TIMER(m_stats.output_seconds);
+
+				for (const auto& triangle : triangles)
 				{
 					*oi++ = triangle;
+					m_facets_read++;
 				}
-				catch (import_cancel_exception&)
+			}
+			catch (import_cancel_exception&)
+			{
+				return;
+			}
+
+			import_finished_();
+			return;
+		}
+
+		begin_read_ahead_();
+
+		if (!m_stl_reader->read_header(m_stl_name))
+			throw std::runtime_error("Error reading STL header");
+
+		triangles.resize(IMPORT_BATCH_SIZE);
+		STL_IMPORT_STAT(m_stats.buffer_allocations++);
+
+		try
+		{
+			while (!m_stl_reader->done())
+			{
+				if (cancel_requested_())
+					return;
+
+				const size_t num_read = read_batch_(triangles);
+
+				STL_IMPORT_TIMER(m_stats.output_seconds);
+
+				for (size_t i = 0 ; i < num_read ; i++)
 				{
+					*oi++ = triangles[i];
+					m_facets_read++;
+				}
+
+				publish_progress_();
+			}
+		}
+		catch (import_cancel_exception&)
+		{
+			return;
+		}
+
+		import_finished_();
+	}
+
+	/** Reads the STL one batch of facets at a time, calling handler(triangles, num_triangles)
+	 *  for each batch, so the whole STL is never held in memory at once.  The triangles
+	 *  are only valid until the handler returns.  Batches are always read on the calling
+	 *  thread, regardless of num_threads().  The import can be stopped with cancel(), or by
+	 *  throwing import_cancel_exception from the handler.  Throws std::runtime_error if the
+	 *  STL header can't be read.
+	 */
+	template <typename BatchHandler>
+	void import_batches(BatchHandler handler)
+	{
+		STL_IMPORT_TIMER(m_stats.total_seconds);
+
+		begin_import_();
+		begin_read_ahead_();
+
+		if (!m_stl_reader->read_header(m_stl_name))
+			throw std::runtime_error("Error reading STL header");
+
+		std::vector<maths::triangle3d> triangles(IMPORT_BATCH_SIZE);
+		STL_IMPORT_STAT(m_stats.buffer_allocations++);
+
+		try
+		{
+			while (!m_stl_reader->done())
+			{
+				if (cancel_requested_())
 					return;
+
+				const size_t num_read = read_batch_(triangles);
+				if (num_read == 0)
+					continue;
+
+				{
+					STL_IMPORT_TIMER(m_stats.output_seconds);
+					handler(static_cast<const maths::triangle3d*>(triangles.data()), num_read);
 				}
 
-				m_facets_read++;
+				m_facets_read += num_read;
+
+				publish_progress_();
 			}
 		}
+		catch (import_cancel_exception&)
+		{
+			return;
+		}
+
+		import_finished_();
 	}
 };
 
@@ -0,0 +1,244 @@
+/*
+ * surface_kernels.cpp
+ */
+
+#include "surface_kernels.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// A few lanes of doubles, as wide as the instruction set allows.
+// Only the handful of operations that the kernels need are defined.
+#if defined(__AVX2__)
+
+struct lanes_t
+{
+	static const size_t WIDTH = 4;
+	__m256d v;
+};
+
+inline lanes_t load(const double* d) { return { _mm256_loadu_pd(d) }; }
+inline lanes_t broadcast(double d) { return { _mm256_set1_pd(d) }; }
+inline void store(double* d, lanes_t a) { _mm256_storeu_pd(d, a.v); }
+
+inline lanes_t operator+(lanes_t a, lanes_t b) { return { _mm256_add_pd(a.v, b.v) }; }
+inline lanes_t operator-(lanes_t a, lanes_t b) { return { _mm256_sub_pd(a.v, b.v) }; }
+inline lanes_t operator*(lanes_t a, lanes_t b) { return { _mm256_mul_pd(a.v, b.v) }; }
+inline lanes_t sqrt(lanes_t a) { return { _mm256_sqrt_pd(a.v) }; }
+inline lanes_t min(lanes_t a, lanes_t b) { return { _mm256_min_pd(a.v, b.v) }; }
+inline lanes_t max(lanes_t a, lanes_t b) { return { _mm256_max_pd(a.v, b.v) }; }
+
+const char* const LANES_ISA = "avx2";
+
+#elif defined(__SSE2__)
+
+struct lanes_t
+{
+	static const size_t WIDTH = 2;
+	__m128d v;
+};
+
+inline lanes_t load(const double* d) { return { _mm_loadu_pd(d) }; }
+inline lanes_t broadcast(double d) { return { _mm_set1_pd(d) }; }
+inline void store(double* d, lanes_t a) { _mm_storeu_pd(d, a.v); }
+
+inline lanes_t operator+(lanes_t a, lanes_t b) { return { _mm_add_pd(a.v, b.v) }; }
+inline lanes_t operator-(lanes_t a, lanes_t b) { return { _mm_sub_pd(a.v, b.v) }; }
+inline lanes_t operator*(lanes_t a, lanes_t b) { return { _mm_mul_pd(a.v, b.v) }; }
+inline lanes_t sqrt(lanes_t a) { return { _mm_sqrt_pd(a.v) }; }
+inline lanes_t min(lanes_t a, lanes_t b) { return { _mm_min_pd(a.v, b.v) }; }
+inline lanes_t max(lanes_t a, lanes_t b) { return { _mm_max_pd(a.v, b.v) }; }
+
+const char* const LANES_ISA = "sse2";
+
+#else
+
+struct lanes_t
+{
+	static const size_t WIDTH = 1;
+	double v;
+};
+
+inline lanes_t load(const double* d) { return { *d }; }
+inline lanes_t broadcast(double d) { return { d }; }
+inline void store(double* d, lanes_t a) { *d = a.v; }
+
+inline lanes_t operator+(lanes_t a, lanes_t b) { return { a.v + b.v }; }
+inline lanes_t operator-(lanes_t a, lanes_t b) { return { a.v - b.v }; }
+inline lanes_t operator*(lanes_t a, lanes_t b) { return { a.v * b.v }; }
+inline lanes_t sqrt(lanes_t a) { return { std::sqrt(a.v) }; }
+inline lanes_t min(lanes_t a, lanes_t b) { return { std::min(a.v, b.v) }; }
+inline lanes_t max(lanes_t a, lanes_t b) { return { std::max(a.v, b.v) }; }
+
+const char* const LANES_ISA = "scalar";
+
+#endif
+
+const size_t WIDTH = lanes_t::WIDTH;
+
+inline double sum_lanes(lanes_t a)
+{
+	double d[WIDTH];
+	store(d, a);
+
+	double sum = 0.0;
+	for (size_t i = 0 ; i < WIDTH ; i++)
+		sum += d[i];
+
+	return sum;
+}
+
+// The corners of WIDTH triangles, one lane per triangle:
+// coords[3 * c + axis][lane] is coordinate axis of corner c.
+struct corner_block
+{
+	double coords[9][WIDTH];
+
+	// Unused lanes are filled with a degenerate triangle at a real corner,
+	// which adds nothing to the sums and doesn't change the bounding box.
+	void pad(size_t num_used)
+	{
+		for (size_t lane = num_used ; lane < WIDTH ; lane++)
+		{
+			for (size_t i = 0 ; i < 9 ; i++)
+				coords[i][lane] = coords[i % 3][0];
+		}
+	}
+};
+
+// Runs the kernel over num_facets triangles, where fill(f, lane, block) puts
+// the corners of triangle f into the given lane of the block.
+template <typename Fill>
+surface_properties compute_surface_properties_(size_t num_facets, Fill fill)
+{
+	surface_properties props;
+	if (num_facets == 0)
+		return props;
+
+	const double inf = std::numeric_limits<double>::infinity();
+
+	lanes_t twice_area = broadcast(0.0);
+	lanes_t six_volume = broadcast(0.0);
+	lanes_t weighted_sum[3] = { broadcast(0.0), broadcast(0.0), broadcast(0.0) };	// twice area * sum of corners
+	lanes_t bbox_min[3] = { broadcast(inf), broadcast(inf), broadcast(inf) };
+	lanes_t bbox_max[3] = { broadcast(-inf), broadcast(-inf), broadcast(-inf) };
+
+	corner_block block;
+
+	for (size_t f = 0 ; f < num_facets ; f += WIDTH)
+	{
+		const size_t num_used = std::min(WIDTH, num_facets - f);
+		for (size_t lane = 0 ; lane < num_used ; lane++)
+			fill(f + lane, lane, block);
+
+		block.pad(num_used);
+
+		lanes_t a[3], b[3], c[3];
+		for (size_t axis = 0 ; axis < 3 ; axis++)
+		{
+			a[axis] = load(block.coords[axis]);
+			b[axis] = load(block.coords[3 + axis]);
+			c[axis] = load(block.coords[6 + axis]);
+		}
+
+		// |(b - a) x (c - a)| is twice the area
+		const lanes_t e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		const lanes_t e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		const lanes_t n[3] =
+		{
+			e1[1] * e2[2] - e1[2] * e2[1],
+			e1[2] * e2[0] - e1[0] * e2[2],
+			e1[0] * e2[1] - e1[1] * e2[0]
+		};
+
+		const lanes_t facet_twice_area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		twice_area = twice_area + facet_twice_area;
+
+		// a . (b x c) is six times the signed volume of the tetrahedron with the origin
+		six_volume = six_volume +
+			a[0] * (b[1] * c[2] - b[2] * c[1]) +
+			a[1] * (b[2] * c[0] - b[0] * c[2]) +
+			a[2] * (b[0] * c[1] - b[1] * c[0]);
+
+		for (size_t axis = 0 ; axis < 3 ; axis++)
+		{
+			weighted_sum[axis] = weighted_sum[axis] + facet_twice_area * (a[axis] + b[axis] + c[axis]);
+
+			bbox_min[axis] = min(bbox_min[axis], min(a[axis], min(b[axis], c[axis])));
+			bbox_max[axis] = max(bbox_max[axis], max(a[axis], max(b[axis], c[axis])));
+		}
+	}
+
+	const double total_twice_area = sum_lanes(twice_area);
+
+	props.area = total_twice_area / 2.0;
+	props.signed_volume = sum_lanes(six_volume) / 6.0;
+
+	if (total_twice_area > 0.0)
+	{
+		props.centroid = maths::vector3d(sum_lanes(weighted_sum[0]), sum_lanes(weighted_sum[1]), sum_lanes(weighted_sum[2]));
+		props.centroid /= 3.0 * total_twice_area;
+	}
+
+	maths::vector3d corners[2];
+	for (size_t axis = 0 ; axis < 3 ; axis++)
+	{
+		double lane_min[WIDTH], lane_max[WIDTH];
+		store(lane_min, bbox_min[axis]);
+		store(lane_max, bbox_max[axis]);
+
+		corners[0][axis] = *std::min_element(lane_min, lane_min + WIDTH);
+		corners[1][axis] = *std::max_element(lane_max, lane_max + WIDTH);
+	}
+
+	props.bbox.add_points(corners, corners + 2);
+
+	return props;
+}
+
+};
+
+surface_properties compute_surface_properties(const maths::vector3d* points, const std::uint32_t* indices, size_t num_facets)
+{
+	return compute_surface_properties_(num_facets, [=](size_t f, size_t lane, corner_block& block)
+	{
+		for (size_t c = 0 ; c < 3 ; c++)
+		{
+			const maths::vector3d& p = points[indices[3 * f + c]];
+			block.coords[3 * c][lane] = p.x();
+			block.coords[3 * c + 1][lane] = p.y();
+			block.coords[3 * c + 2][lane] = p.z();
+		}
+	});
+}
+
+surface_properties compute_surface_properties(const triangle_soup& soup)
+{
+	const float* x = soup.x();
+	const float* y = soup.y();
+	const float* z = soup.z();
+
+	return compute_surface_properties_(soup.size(), [=](size_t f, size_t lane, corner_block& block)
+	{
+		for (size_t c = 0 ; c < 3 ; c++)
+		{
+			block.coords[3 * c][lane] = x[3 * f + c];
+			block.coords[3 * c + 1][lane] = y[3 * f + c];
+			block.coords[3 * c + 2][lane] = z[3 * f + c];
+		}
+	});
+}
+
+const char* surface_kernels_isa()
+{
+	return LANES_ISA;
+}
@@ -0,0 +1,42 @@
+/*
+ * surface_kernels.h
+ *
+ * Vectorized area, volume, centroid and bounding box computations over
+ * contiguous triangle layouts.
+ */
+
+#ifndef SURFACE_KERNELS_H_
+#define SURFACE_KERNELS_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+#include "geom.h"
+#include "triangle_soup.h"
+
+/** Properties of a set of triangles that are all computed in the same pass */
+struct surface_properties
+{
+	double			area = 0.0;
+	double			signed_volume = 0.0;	// of the solid bounded by the triangles, if they are closed
+	maths::vector3d	centroid;				// area-weighted centroid of the triangles
+	maths::bbox3d	bbox;					// of the triangle corners
+
+	double volume() const { return std::abs(signed_volume); }
+};
+
+/** Computes the properties of an indexed triangle mesh, where facet f has corners
+ *  points[indices[3f]], points[indices[3f + 1]] and points[indices[3f + 2]].
+ */
+surface_properties compute_surface_properties(const maths::vector3d* points, const std::uint32_t* indices, size_t num_facets);
+
+/** Computes the properties of the triangles in soup */
+surface_properties compute_surface_properties(const triangle_soup& soup);
+
+/** The instruction set that the kernels were compiled for: "avx2", "sse2" or "scalar".
+ *  AVX2 is only used if the library is built with it enabled (e.g. the ENABLE_AVX2 CMake option).
+ */
+const char* surface_kernels_isa();
+
+#endif /* SURFACE_KERNELS_H_ */
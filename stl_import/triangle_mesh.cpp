@@ -6,6 +6,11 @@
  */
 
 #include "triangle_mesh.h"
+#include "parallel.h"
+#include "stl_exporter.h"
+
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <iterator>
 #include <algorithm>
@@ -111,8 +116,12 @@ maths::vector3d mesh_edge::p1() const { return get_halfedge()->get_end_point();
 
 maths::triangle3d mesh_facet::get_triangle() const
 {
-	vector<mesh_vertex_ptr> verts = get_verts();
-	maths::triangle3d triangle(verts[0]->get_point(), verts[1]->get_point(), verts[2]->get_point());
+	// Walk the halfedges rather than calling get_verts(), so that we don't allocate
+	const mesh_halfedge_ptr e0 = m_halfedge.lock();
+	const mesh_halfedge_ptr e1 = e0->get_next_halfedge();
+	const mesh_halfedge_ptr e2 = e1->get_next_halfedge();
+
+	maths::triangle3d triangle(e0->get_vertex()->get_point(), e1->get_vertex()->get_point(), e2->get_vertex()->get_point());
 
 	return triangle;
 }
@@ -235,9 +244,13 @@ maths::vector3d mesh_vertex::get_normal() const
 	return vert_normal;
 }
 
+std::atomic<std::uint64_t> mesh_vertex::s_geometry_revision(0);
+
 maths::vector3d& mesh_vertex::set_point(const maths::vector3d& point)
 {
 	m_point = point;
+	s_geometry_revision.fetch_add(1, std::memory_order_relaxed);
+
 	return m_point;
 }
 
@@ -277,11 +290,23 @@ bool triangle_mesh::operator==(const triangle_mesh& other) const
 
 void triangle_mesh::reset()
 {
-	m_bbox = maths::bbox3d();
+	reset_property_cache_();
+	m_num_lamina_halfedges = 0;
 
 	m_halfedges.clear();
+	m_edges.clear();
 	m_verts.clear();
 	m_facets.clear();
+
+	m_vertex_welder.clear();
+	m_welded_verts.clear();
+	m_halfedge_map.clear();
+}
+
+void triangle_mesh::set_weld_tolerance(double tolerance)
+{
+	m_vertex_welder = vertex_welder(tolerance);
+	m_welded_verts.clear();
 }
 
 bool triangle_mesh::is_empty() const
@@ -291,133 +316,418 @@ bool triangle_mesh::is_empty() const
 
 void triangle_mesh::add_triangle(const maths::triangle3d& t)
 {
-	vector<mesh_halfedge_ptr> triangle_halfedges;
+	mesh_halfedge_ptr triangle_halfedges[3];
 
 	// First, connect the halfedges of the triangle
+	for (int i = 0 ; i < 3 ; i++)
+		triangle_halfedges[i] = std::make_shared<mesh_halfedge>();
+
+	STL_IMPORT_STAT(m_build_stats.allocations += 3);
+
 	for (int i = 0 ; i < 3 ; i++)
 	{
-		mesh_halfedge_ptr e(new mesh_halfedge);
-		triangle_halfedges.push_back(e);
+		triangle_halfedges[i]->set_next_halfedge(triangle_halfedges[(i + 1) % 3]);
+		triangle_halfedges[i]->set_prev_halfedge(triangle_halfedges[(i + 2) % 3]);
 	}
 
+	// Weld the corners of this triangle to the mesh vertices
+	vertex_welder::index_t triangle_vert_indices[3];
 	for (int i = 0 ; i < 3 ; i++)
+		triangle_vert_indices[i] = m_vertex_welder.weld(t[i]).first;
+
+	m_welded_verts.resize(m_vertex_welder.size());
+
+	if (triangle_vert_indices[0] == triangle_vert_indices[1] ||
+		triangle_vert_indices[1] == triangle_vert_indices[2] ||
+		triangle_vert_indices[2] == triangle_vert_indices[0])
 	{
-		triangle_halfedges[i]->set_next_halfedge(triangle_halfedges[(i + 1) % 3]);
-		triangle_halfedges[i]->set_prev_halfedge(i == 0 ? triangle_halfedges[2] : triangle_halfedges[i - 1]);
+		// Only happens when welding with a tolerance, otherwise
+		// degenerate triangles are added as-is.
+		if (m_vertex_welder.tolerance() > 0.0)
+			return;
 	}
 
 	// Set the vertices of this triangle
+	mesh_vertex_ptr triangle_verts[3];
+
 	for (int i = 0 ; i < 3 ; i++)
 	{
-		mesh_halfedge_ptr e = triangle_halfedges[i];
-		const maths::vector3d& e_v = t[i];
+		const mesh_halfedge_ptr& e = triangle_halfedges[i];
+		mesh_vertex_ptr& v = m_welded_verts[triangle_vert_indices[i]];
 
-		vertex_halfedge_map_t::iterator ve = m_vertex_halfedge_map.find(e_v);
-		if (ve == m_vertex_halfedge_map.end())
+		if (!v)
 		{
-			mesh_vertex_ptr halfedge_start_vert(new mesh_vertex(e_v));
-			e->set_vertex(halfedge_start_vert);
-			halfedge_start_vert->set_halfedge(e);
-
-			// Insert this halfedge / vertex pair into our map
-			std::vector<mesh_halfedge_ptr> vertex_halfedges;
-			vertex_halfedges.push_back(e);
-			m_vertex_halfedge_map.insert(std::make_pair(e_v, vertex_halfedges));
+			v = std::make_shared<mesh_vertex>(m_vertex_welder.get_point(triangle_vert_indices[i]));
+			v->set_halfedge(e);
+			STL_IMPORT_STAT(m_build_stats.allocations++);
 
 			// Insert the vertex to the global list of vertices
-			m_verts.push_back(halfedge_start_vert);
+			m_verts.push_back(v);
 		}
-		else
-		{
-			std::vector<mesh_halfedge_ptr>& vertex_halfedges = ve->second;
-			if (vertex_halfedges.empty())
-				throw std::runtime_error("Empty halfedge / vertices association");
-
-			mesh_vertex_ptr v = (*vertex_halfedges.begin())->get_vertex();
-			if (std::find_if(vertex_halfedges.begin() + 1, vertex_halfedges.end(),
-				[&v](const mesh_halfedge_ptr & e) { return e->get_vertex() != v; }) != vertex_halfedges.end())
-			{
-				throw std::runtime_error("bad halfedge vertex");
-			}
-
-			if (!v)
-				throw std::runtime_error("got NULL vertex!");
 
-			e->set_vertex(v);
-
-			auto p_sym_halfedge = std::find_if(vertex_halfedges.begin(), vertex_halfedges.end(),
-				[&e_v, &t, i](mesh_halfedge_ptr e) {
-					auto pe = e ? e->get_prev_halfedge() : nullptr;
-					if (!pe)
-						return false;
+		e->set_vertex(v);
+		triangle_verts[i] = v;
+	}
 
-					auto pe_ev = pe->get_end_vertex();
-					auto pe_v = pe->get_vertex();
+	// Find the symmetric halfedge of each of our halfedges, i.e. a halfedge that
+	// goes between the same two vertices in the opposite direction.
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		const mesh_halfedge_ptr& e = triangle_halfedges[i];
+		const mesh_vertex* v_start = triangle_verts[i].get();
+		const mesh_vertex* v_end = triangle_verts[(i + 1) % 3].get();
 
-					if (!pe_ev || !pe_v)
-						return false;
+		const mesh_halfedge_ptr* p_sym_halfedge = m_halfedge_map.find(std::make_pair(v_end, v_start));
+		if (p_sym_halfedge)
+		{
+			const mesh_halfedge_ptr& e_sym = *p_sym_halfedge;
 
-					return pe_ev->get_point() == e_v && pe_v->get_point() == t[i + 1];
-				}
-			);
+			// e_sym might already have been paired up with some other halfedge
+			if (e_sym->is_lamina())
+				m_num_lamina_halfedges--;
 
-			if (p_sym_halfedge != vertex_halfedges.end())
-			{
-				mesh_halfedge_ptr e_sym = (*p_sym_halfedge)->get_prev_halfedge();
+			e->set_sym_halfedge(e_sym);
+			e_sym->set_sym_halfedge(e);
 
-				if (e_sym->get_end_vertex()->get_point() != e_v)
-					throw std::runtime_error("symmetric halfedge point mismatch");
+			m_edges.emplace_back(std::make_shared<mesh_edge>(e, e_sym));
+			STL_IMPORT_STAT(m_build_stats.allocations++);
+		}
+		else
+		{
+			m_num_lamina_halfedges++;
+		}
 
-				e->set_sym_halfedge(e_sym);
-				e_sym->set_sym_halfedge(e);
+		m_halfedge_map.insert(std::make_pair(v_start, v_end), e);
+	}
 
-				m_edges.emplace_back(std::make_shared<mesh_edge>(e, e_sym));
-			}
+	// Set the facet of this triangle, and set the start halfedge of the facet.
+	// Our vertices might not be exactly at the corners of t if they were welded.
+	const maths::triangle3d welded_t(triangle_verts[0]->get_point(), triangle_verts[1]->get_point(), triangle_verts[2]->get_point());
 
-			vertex_halfedges.push_back(e);
-		}
-	}
+	mesh_facet_ptr f(new mesh_facet(welded_t.normal()));
+	STL_IMPORT_STAT(m_build_stats.allocations++);
 
-	// Set the facet of this triangle, and set the start halfedge of the facet
-	mesh_facet_ptr f(new mesh_facet(t.normal()));
 	for (auto & triangle_halfedge : triangle_halfedges)
 		triangle_halfedge->set_facet(f);
 
-	f->set_halfedge(triangle_halfedges.back());
+	f->set_halfedge(triangle_halfedges[2]);
 	m_facets.push_back(f);
 
+	// Keep the cached properties up to date, rather than throwing them away
+	if (property_cache_is_current_())
+	{
+		m_property_cache.signed_volume += welded_t.signed_volume();
+		m_property_cache.area += welded_t.area();
+
+		for (const auto& v : triangle_verts)
+			m_property_cache.bbox.add_points(&v->get_point(), &v->get_point() + 1);
+	}
+
 	// Add the triangle halfedges to the list of halfedges
-	std::copy(triangle_halfedges.begin(), triangle_halfedges.end(), std::back_inserter(m_halfedges));
+	std::copy(std::begin(triangle_halfedges), std::end(triangle_halfedges), std::back_inserter(m_halfedges));
 }
 
 void triangle_mesh::build(const vector<maths::triangle3d>& triangles)
 {
+	m_build_stats = stl_util::mesh_build_stats();
+	STL_IMPORT_TIMER(m_build_stats.total_seconds);
+
 	if (!is_empty())
 		reset();
 
-	m_vertex_halfedge_map.clear();
+	// The properties are built up along with the mesh
+	reset_property_cache_();
+
+	m_halfedges.reserve(3 * triangles.size());
+	m_facets.reserve(triangles.size());
+
+	// A closed mesh has about half as many vertices as facets
+	m_vertex_welder.reserve(triangles.size() / 2);
+	m_halfedge_map.reserve(3 * triangles.size());
+
 	std::for_each(triangles.begin(), triangles.end(), std::bind(&triangle_mesh::add_triangle, this, _1));
-	m_vertex_halfedge_map.clear();	// don't need this no mo
+
+	// don't need these no mo
+	m_vertex_welder.clear();
+	m_welded_verts.clear();
+	m_halfedge_map.clear();
+
+	STL_IMPORT_STAT(m_build_stats.facets = m_facets.size());
+	STL_IMPORT_STAT(m_build_stats.vertices = m_verts.size());
 }
 
-const maths::bbox3d& triangle_mesh::bbox() const
+void triangle_mesh::build(const vector<maths::triangle3d>& triangles, unsigned num_threads)
 {
-	if (m_bbox.is_empty())
+	using stl_util::parallel_for;
+	using stl_util::parallel_sort;
+
+	typedef std::uint32_t index_t;
+	const index_t INVALID_INDEX = ~index_t(0);
+	const size_t BLOCK_SIZE = 1 << 12;	// facets, vertices or halfedges per parallel task
+
+	if (weld_tolerance() > 0.0)
 	{
-		maths::bbox3d mesh_bbox;
+		build(triangles);
+		return;
+	}
+
+	m_build_stats = stl_util::mesh_build_stats();
+	STL_IMPORT_TIMER(m_build_stats.total_seconds);
+
+	if (!is_empty())
+		reset();
+
+	const size_t num_facets = triangles.size();
+	const size_t num_corners = 3 * num_facets;	// one halfedge per corner
+
+	if (num_corners >= INVALID_INDEX)
+		throw std::runtime_error("Too many triangles");
 
-		std::vector<maths::vector3d> vertex_points(m_verts.size());
-		std::transform(m_verts.begin(), m_verts.end(), vertex_points.begin(), std::mem_fn(&mesh_vertex::get_point));
-		mesh_bbox.add_points(vertex_points.begin(), vertex_points.end());
+	STL_IMPORT_STAT(stl_util::phase_timer build_phases);
 
-		m_bbox = mesh_bbox;
+	auto corner_point = [&triangles](index_t c) -> const maths::vector3d& { return triangles[c / 3][c % 3]; };
+	auto num_blocks = [BLOCK_SIZE](size_t n) { return (n + BLOCK_SIZE - 1) / BLOCK_SIZE; };
+
+	// compare_points isn't a strict weak ordering once there are NaNs about (which a corrupt
+	// STL can have), and sorting with it would be undefined.  Comparing the coordinates' bits,
+	// arranged so that they order like the numbers do, is a total order.  -0.0 is made 0.0
+	// first, so that they're the same point as they are to compare_points.
+	auto coord_key = [](double d) -> std::uint64_t
+	{
+		const std::uint64_t SIGN_BIT = std::uint64_t(1) << 63;
+
+		if (d == 0.0)
+			d = 0.0;
+
+		std::uint64_t bits;
+		std::memcpy(&bits, &d, sizeof(bits));
+
+		return (bits & SIGN_BIT) ? ~bits : bits | SIGN_BIT;
+	};
+
+	auto less_point = [&coord_key](const maths::vector3d& p1, const maths::vector3d& p2)
+	{
+		for (size_t i = 0 ; i < 3 ; i++)
+		{
+			const std::uint64_t k1 = coord_key(p1[i]);
+			const std::uint64_t k2 = coord_key(p2[i]);
+
+			if (k1 != k2)
+				return k1 < k2;
+		}
+
+		return false;
+	};
+
+	// Sort the triangle corners by point, so that all of the corners at the
+	// same point are next to each other, in the order that they appear in triangles.
+	vector<index_t> sorted_corners(num_corners);
+	std::iota(sorted_corners.begin(), sorted_corners.end(), 0);
+
+	parallel_sort(sorted_corners.begin(), sorted_corners.end(), [&](index_t c1, index_t c2)
+		{
+			const maths::vector3d& p1 = corner_point(c1);
+			const maths::vector3d& p2 = corner_point(c2);
+
+			if (less_point(p1, p2))
+				return true;
+			if (less_point(p2, p1))
+				return false;
+
+			return c1 < c2;
+		},
+		num_threads);
+
+	// Associate each corner with the first corner at the same point...
+	vector<index_t> corner_vertex(num_corners);
+	for (size_t i = 0 ; i < num_corners ; i++)
+	{
+		const bool new_point = i == 0 || less_point(corner_point(sorted_corners[i - 1]), corner_point(sorted_corners[i]));
+		corner_vertex[sorted_corners[i]] = new_point ? sorted_corners[i] : corner_vertex[sorted_corners[i - 1]];
+	}
+
+	// ...and then number the vertices in the order that add_triangle() would have created them.
+	// The first corner at a point always comes before the others, so it's already been numbered.
+	vector<index_t> vertex_first_corner;
+	for (index_t c = 0 ; c < (index_t) num_corners ; c++)
+	{
+		if (corner_vertex[c] == c)
+		{
+			corner_vertex[c] = (index_t) vertex_first_corner.size();
+			vertex_first_corner.push_back(c);
+		}
+		else
+			corner_vertex[c] = corner_vertex[corner_vertex[c]];
 	}
-	return m_bbox;
+
+	const size_t num_verts = vertex_first_corner.size();
+	STL_IMPORT_STAT(build_phases.lap(m_build_stats.weld_seconds));
+
+	m_verts.resize(num_verts);
+	parallel_for(num_blocks(num_verts), num_threads, [&](size_t block)
+	{
+		for (size_t v = block * BLOCK_SIZE ; v < std::min(num_verts, (block + 1) * BLOCK_SIZE) ; v++)
+			m_verts[v] = std::make_shared<mesh_vertex>(corner_point(vertex_first_corner[v]));
+	});
+
+	// Create the facets and their halfedges
+	m_halfedges.resize(num_corners);
+	m_facets.resize(num_facets);
+	parallel_for(num_blocks(num_facets), num_threads, [&](size_t block)
+	{
+		for (size_t fi = block * BLOCK_SIZE ; fi < std::min(num_facets, (block + 1) * BLOCK_SIZE) ; fi++)
+		{
+			mesh_halfedge_ptr* triangle_halfedges = &m_halfedges[3 * fi];
+			for (size_t i = 0 ; i < 3 ; i++)
+				triangle_halfedges[i] = std::make_shared<mesh_halfedge>();
+
+			mesh_facet_ptr f(new mesh_facet(triangles[fi].normal()));
+
+			for (size_t i = 0 ; i < 3 ; i++)
+			{
+				const index_t c = (index_t) (3 * fi + i);
+				const mesh_halfedge_ptr& e = triangle_halfedges[i];
+				const mesh_vertex_ptr& v = m_verts[corner_vertex[c]];
+
+				e->set(v, f, triangle_halfedges[(i + 2) % 3], triangle_halfedges[(i + 1) % 3], nullptr);
+
+				if (vertex_first_corner[corner_vertex[c]] == c)
+					v->set_halfedge(e);
+			}
+
+			f->set_halfedge(triangle_halfedges[2]);
+			m_facets[fi] = f;
+		}
+	});
+
+	STL_IMPORT_STAT(build_phases.lap(m_build_stats.create_seconds));
+
+	// Sort the halfedges by their (start, end) vertices
+	auto halfedge_key = [&corner_vertex](index_t e)
+	{
+		const index_t e_next = e - e % 3 + (e + 1) % 3;
+		return (std::uint64_t) corner_vertex[e] << 32 | corner_vertex[e_next];
+	};
+
+	vector<std::uint64_t> halfedge_keys(num_corners);
+	parallel_for(num_blocks(num_corners), num_threads, [&](size_t block)
+	{
+		for (size_t e = block * BLOCK_SIZE ; e < std::min(num_corners, (block + 1) * BLOCK_SIZE) ; e++)
+			halfedge_keys[e] = halfedge_key((index_t) e);
+	});
+
+	vector<index_t> sorted_halfedges(num_corners);
+	std::iota(sorted_halfedges.begin(), sorted_halfedges.end(), 0);
+
+	parallel_sort(sorted_halfedges.begin(), sorted_halfedges.end(), [&halfedge_keys](index_t e1, index_t e2)
+		{
+			return halfedge_keys[e1] < halfedge_keys[e2] || (halfedge_keys[e1] == halfedge_keys[e2] && e1 < e2);
+		},
+		num_threads);
+
+	// The first and last halfedges with the given key, or INVALID_INDEX if there aren't any
+	auto find_halfedges = [&](std::uint64_t key)
+	{
+		auto first = std::lower_bound(sorted_halfedges.begin(), sorted_halfedges.end(), key,
+			[&halfedge_keys](index_t e, std::uint64_t k) { return halfedge_keys[e] < k; });
+		auto last = std::upper_bound(first, sorted_halfedges.end(), key,
+			[&halfedge_keys](std::uint64_t k, index_t e) { return k < halfedge_keys[e]; });
+
+		if (first == last)
+			return std::make_pair(INVALID_INDEX, INVALID_INDEX);
+
+		return std::make_pair(*first, *(last - 1));
+	};
+
+	// add_triangle() connects each new halfedge to the first halfedge that was added going the
+	// other way (if there is one), and vice-versa.  That means that the first halfedge of a
+	// non-manifold edge ends up connected to the last halfedge that was added going the other way.
+	vector<mesh_edge_ptr> halfedge_edges(num_corners);
+	parallel_for(num_blocks(num_corners), num_threads, [&](size_t block)
+	{
+		for (index_t e = block * BLOCK_SIZE ; e < std::min(num_corners, (block + 1) * BLOCK_SIZE) ; e++)
+		{
+			const std::uint64_t key = halfedge_keys[e];
+			const std::uint64_t sym_key = key << 32 | key >> 32;
+
+			const index_t first_halfedge = find_halfedges(key).first;
+			index_t first_sym, last_sym;
+			std::tie(first_sym, last_sym) = find_halfedges(sym_key);
+
+			index_t e_sym = INVALID_INDEX;
+			if (first_sym != INVALID_INDEX && first_sym < e)
+			{
+				e_sym = first_sym;
+				halfedge_edges[e] = std::make_shared<mesh_edge>(m_halfedges[e], m_halfedges[first_sym]);
+			}
+
+			if (first_halfedge == e && last_sym != INVALID_INDEX && last_sym > e)
+				e_sym = last_sym;
+
+			if (e_sym != INVALID_INDEX)
+				m_halfedges[e]->set_sym_halfedge(m_halfedges[e_sym]);
+		}
+	});
+
+	for (auto& edge : halfedge_edges)
+	{
+		if (edge)
+			m_edges.push_back(std::move(edge));
+	}
+
+	m_num_lamina_halfedges = (size_t) std::count_if(m_halfedges.begin(), m_halfedges.end(), std::mem_fn(&mesh_halfedge::is_lamina));
+	m_property_cache.valid = false;	// computed on demand
+
+	STL_IMPORT_STAT(build_phases.lap(m_build_stats.connect_seconds));
+	STL_IMPORT_STAT(m_build_stats.facets = num_facets);
+	STL_IMPORT_STAT(m_build_stats.vertices = num_verts);
+	STL_IMPORT_STAT(m_build_stats.allocations = num_verts + 4 * num_facets + m_edges.size());
+}
+
+void triangle_mesh::reset_property_cache_()
+{
+	m_property_cache = property_cache();
+	m_property_cache.valid = true;
+	m_property_cache.revision = mesh_vertex::geometry_revision();
+}
+
+const triangle_mesh::property_cache& triangle_mesh::get_property_cache_() const
+{
+	if (property_cache_is_current_())
+		return m_property_cache;
+
+	// Grab the revision first, so that anything that moves while we're working makes us stale
+	property_cache cache;
+	cache.revision = mesh_vertex::geometry_revision();
+
+	for (const mesh_facet_ptr& f : m_facets)
+	{
+		const maths::triangle3d t = f->get_triangle();
+
+		cache.signed_volume += t.signed_volume();
+		cache.area += t.area();
+	}
+
+	for (const mesh_vertex_ptr& vert : m_verts)
+	{
+		const maths::vector3d& p = vert->get_point();
+		cache.bbox.add_points(&p, &p + 1);
+	}
+
+	cache.valid = true;
+	m_property_cache = cache;
+
+	return m_property_cache;
+}
+
+const maths::bbox3d& triangle_mesh::bbox() const
+{
+	return get_property_cache_().bbox;
 }
 
 bool triangle_mesh::is_manifold() const
 {
-	return std::find_if(m_halfedges.begin(), m_halfedges.end(), std::mem_fn(&mesh_halfedge::is_lamina)) == m_halfedges.end();
+	return m_num_lamina_halfedges == 0;
 }
 
 vector<mesh_halfedge_ptr> triangle_mesh::get_lamina_halfedges() const
@@ -428,58 +738,60 @@ vector<mesh_halfedge_ptr> triangle_mesh::get_lamina_halfedges() const
 	return lamina_halfedges;
 }
 
-triangle_mesh::vbo_data_t triangle_mesh::get_vbo_data() const
+std::vector<std::uint32_t> triangle_mesh::get_vertex_indices_() const
 {
-	vbo_data_t vbo_data;
+	open_hash_map<const mesh_vertex*, std::uint32_t, pointer_hash> vertex_index_map;
+	vertex_index_map.reserve(m_verts.size());
 
-	// First, build the index list
-	// Maybe there is a more efficient way to do this?
-	typedef std::map<maths::vector3d, unsigned int, compare_points> vertex_index_map_t;
-	vertex_index_map_t vertex_index_map;
+	for (size_t v = 0 ; v < m_verts.size() ; v++)
+		vertex_index_map.insert(m_verts[v].get(), (std::uint32_t) v);
 
-	const std::vector<mesh_vertex_ptr>& mesh_verts = get_vertices();
-	const std::vector<mesh_facet_ptr>& mesh_facets = get_facets();
-	for (mesh_facet_ptr facet : mesh_facets)
-	{
-		std::vector<mesh_vertex_ptr> facet_verts = facet->get_verts();
+	std::vector<std::uint32_t> indices;
+	indices.reserve(3 * m_facets.size());
 
-		for (size_t i = 0 ; i < 3 ; i++)
+	for (const mesh_facet_ptr& facet : m_facets)
+	{
+		const mesh_halfedge_ptr start_halfedge = facet->get_halfedge();
+		mesh_halfedge_ptr e = start_halfedge;
+		do
 		{
-			mesh_vertex_ptr vi = facet_verts[i];
-			vertex_index_map_t::iterator vert_index = vertex_index_map.find(vi->get_point());
-			if (vert_index == vertex_index_map.end())
-			{
-				const maths::vector3d& vi_pt = vi->get_point();
-				auto matching_vert = std::find_if(mesh_verts.begin(), mesh_verts.end(),
-					[&vi_pt](const mesh_vertex_ptr & vp) { return vp->get_point() == vi_pt; });
-
-				if (matching_vert == mesh_verts.end())
-					throw std::runtime_error("Couldn't find matching vert!");
-
-				// Constant-time complexity for random access iterator
-				const unsigned int idx = (unsigned int) std::distance(mesh_verts.begin(), matching_vert);
-				std::tie(vert_index, std::ignore) = vertex_index_map.insert(std::make_pair(vi_pt, idx));
-			}
+			const std::uint32_t* vert_index = vertex_index_map.find(e->get_vertex().get());
+			if (!vert_index)
+				throw std::runtime_error("Couldn't find matching vert!");
 
-			vbo_data.indices.push_back(vert_index->second);
+			indices.push_back(*vert_index);
+			e = e->get_next_halfedge();
 		}
+		while (e != start_halfedge);
 	}
 
+	return indices;
+}
+
+triangle_mesh::vbo_data_t triangle_mesh::get_vbo_data() const
+{
+	vbo_data_t vbo_data;
+	vbo_data.indices = get_vertex_indices_();
+
 	// Next, add the normals and vertices
-	for (mesh_vertex_ptr mesh_vert : mesh_verts)
+	vbo_data.verts.reserve(m_verts.size());
+	vbo_data.normals.reserve(m_verts.size());
+
+	for (const mesh_vertex_ptr& mesh_vert : m_verts)
 	{
-		double* vert = new double[3];
-		double* normal = new double[3];
-		vert[0] = mesh_vert->get_point().x();
-		vert[1] = mesh_vert->get_point().y();
-		vert[2] = mesh_vert->get_point().z();
+		const maths::vector3d& point = mesh_vert->get_point();
+		const maths::vector3d normal = mesh_vert->get_normal();
 
-		normal[0] = mesh_vert->get_normal().x();
-		normal[1] = mesh_vert->get_normal().y();
-		normal[2] = mesh_vert->get_normal().z();
+		double* vert = new double[3];
+		double* vert_normal = new double[3];
+		for (size_t i = 0 ; i < 3 ; i++)
+		{
+			vert[i] = point[i];
+			vert_normal[i] = normal[i];
+		}
 
 		vbo_data.verts.push_back(vert);
-		vbo_data.normals.push_back(normal);
+		vbo_data.normals.push_back(vert_normal);
 	}
 
 	return vbo_data;
@@ -487,33 +799,12 @@ triangle_mesh::vbo_data_t triangle_mesh::get_vbo_data() const
 
 double triangle_mesh::volume() const
 {
-	// Maybe cache this
-	// Compute signed volume of each triangle in the mesh
-	double volume = std::accumulate(m_facets.begin(), m_facets.end(), 0.0,
-		[](double vol, const mesh_facet_ptr & f)
-		{
-			maths::triangle3d t = f->get_triangle();
-			vol += t.signed_volume();
-
-			return vol;
-		}
-	);
-
-	return std::abs(volume);
+	return std::abs(get_property_cache_().signed_volume);
 }
 
 double triangle_mesh::area() const
 {
-	// This should probably be cached, too.
-	double area = std::accumulate(m_facets.begin(), m_facets.end(), 0.0,
-		[](double a, const mesh_facet_ptr & f)
-		{
-			maths::triangle3d t = f->get_triangle();
-			return a += t.area();
-		}
-	);
-
-	return area;
+	return get_property_cache_().area;
 }
 
 void triangle_mesh::center()
@@ -529,29 +820,16 @@ void triangle_mesh::center()
 
 ostream& operator<<(ostream& os, const triangle_mesh& mesh)
 {
-	const vector<mesh_facet_ptr>& facets = mesh.get_facets();
-
-	os << "solid" << std::endl;	// TODO - add mesh name
-
-	for (mesh_facet_ptr f : facets)
+	// Streams report errors in their state, not by throwing (unless they've been asked to)
+	try
 	{
-		const maths::triangle3d t = f->get_triangle();
-		const maths::vector3d n = f->get_normal();
-
-		os << "facet normal ";
-		os << setprecision(6) << n.x() << " " << n.y() << " " << n.z() << std::endl;
-
-		os << "\t" << "outer loop" << std::endl;
-		for (int i = 0 ; i < 3 ; i++)
-		{
-			const maths::vector3d& p = t[i];
-			os << "\t\t" << "vertex " << "\t" << setprecision(6) << p.x() << " " << p.y() << " " << p.z() << std::endl;
-		}
-		os << "\t" << "endloop" << std::endl;
-		os << "endfacet" << std::endl;
+		stl_util::stl_exporter exporter(os, stl_util::stl_format::ascii);
+		exporter.write(mesh);
+	}
+	catch (std::runtime_error&)
+	{
+		os.setstate(std::ios::failbit);
 	}
-
-	os << "endsolid";
 
 	return os;
 }
@@ -11,8 +11,14 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <cstdint>
 
 #include "geom.h"
+#include "open_hash_map.h"
+#include "vertex_welder.h"
+#include "vbo_buffer.h"
+#include "instrumentation.h"
 
 class mesh_vertex;
 class mesh_halfedge;
@@ -120,6 +126,7 @@ public:
 	: m_normal(normal) { }
 
 	void set_halfedge(const mesh_halfedge_ptr& halfedge) { m_halfedge = halfedge; }
+	mesh_halfedge_ptr get_halfedge() const { return m_halfedge.lock(); }
 
 	const maths::vector3d& get_normal() const { return m_normal; }
 	void set_normal(const maths::vector3d& normal) { m_normal = normal; }
@@ -139,6 +146,8 @@ private:
 	mesh_halfedge_weak	m_halfedge;
 	maths::vector3d	m_point;
 
+	static std::atomic<std::uint64_t>	s_geometry_revision;
+
 public:
 	mesh_vertex(const maths::vector3d& point)
 	: m_point(point) { }
@@ -155,6 +164,10 @@ public:
 	const maths::vector3d& get_point() const { return m_point; }
 	maths::vector3d& set_point(const maths::vector3d& p);
 
+	/** Bumped whenever any vertex is moved with set_point(),
+	 *  so that meshes know when their cached properties are stale. */
+	static std::uint64_t geometry_revision() { return s_geometry_revision.load(std::memory_order_relaxed); }
+
 	// halfedge_iterator, vertex_iterator
 
 	friend std::ostream& operator<<(std::ostream& os, const mesh_vertex& vertex);
@@ -169,10 +182,25 @@ private:
 	std::vector<mesh_facet_ptr>		m_facets;
 	std::vector<mesh_vertex_ptr>	m_verts;
 
-	mutable maths::bbox3d			m_bbox;	// cached for speed
+	// Cached properties, so they don't have to be recomputed on every call.
+	// The cache is valid while revision matches mesh_vertex::geometry_revision(),
+	// i.e. until some vertex is moved.  add_triangle() keeps it up to date.
+	struct property_cache
+	{
+		bool			valid = false;
+		std::uint64_t	revision = 0;
+		double			signed_volume = 0.0;
+		double			area = 0.0;
+		maths::bbox3d	bbox;
+	};
+
+	mutable property_cache			m_property_cache;
+	size_t							m_num_lamina_halfedges = 0;	// maintained as the topology changes
 
 	std::string						m_name;
 
+	stl_util::mesh_build_stats		m_build_stats;	// only filled in by instrumented builds
+
 	// I'm a bit iffy on defining operator< for
 	// maths::n_vector, so for now, we'll compare
 	// points using this functor
@@ -216,13 +244,25 @@ private:
 	};
 
 	// Used when building the mesh from a set of triangles
-	// Associates a point to the set of all halfedges that have this vector as their starting point
-	typedef std::map<maths::vector3d, std::vector<mesh_halfedge_ptr>, compare_points> vertex_halfedge_map_t;
-	vertex_halfedge_map_t m_vertex_halfedge_map;
+	// The welder associates each point with a vertex index, and m_welded_verts
+	// holds the mesh vertex for each of those (or null if no facet uses it yet).
+	// The start and end vertices of each halfedge are associated with the
+	// halfedge, so that we can find symmetric halfedges.
+	typedef open_hash_map<std::pair<const mesh_vertex*, const mesh_vertex*>, mesh_halfedge_ptr, pair_hash> halfedge_map_t;
+	vertex_welder					m_vertex_welder;
+	std::vector<mesh_vertex_ptr>	m_welded_verts;
+	halfedge_map_t					m_halfedge_map;
+
+	bool property_cache_is_current_() const { return m_property_cache.valid && m_property_cache.revision == mesh_vertex::geometry_revision(); }
+	const property_cache& get_property_cache_() const;	// recomputes the cache if it's stale
+	void reset_property_cache_();						// to the properties of an empty mesh
+
+	/** The index (in m_verts) of each facet's vertices, 3 per facet */
+	std::vector<std::uint32_t> get_vertex_indices_() const;
 
 public:
 	/** Create an empty triangle mesh */
-	triangle_mesh() { }
+	triangle_mesh() { reset_property_cache_(); }
 
 	/** Create a mesh from a bunch of triangles */
 	triangle_mesh(const std::vector<maths::triangle3d>& triangles);
@@ -251,6 +291,26 @@ public:
 	/** Builds a new mesh from the given set of triangles */
 	void build(const std::vector<maths::triangle3d>& triangles);
 
+	/** Builds the same mesh as build(triangles), using up to num_threads threads (0 means one per core).
+	 *  Rather than adding one triangle at a time, the triangle corners are sorted by point to find
+	 *  the unique vertices, and the halfedges are sorted by their start and end vertices to find
+	 *  symmetric halfedges.
+	 */
+	void build(const std::vector<maths::triangle3d>& triangles, unsigned num_threads);
+
+	/** Where the time went in the last build().  Always zero unless the library
+	 *  was built with STL_IMPORT_INSTRUMENTATION, see instrumentation.h.
+	 */
+	const stl_util::mesh_build_stats& build_stats() const { return m_build_stats; }
+
+	/** Sets the distance within which triangle corners are welded into the same vertex,
+	 *  for triangles added from here on.  With the default of 0, only identical points are welded.
+	 *  Triangles that collapse when their corners are welded are not added to the mesh.
+	 *  Welding with a tolerance is done serially, even by the multi-threaded build().
+	 */
+	void set_weld_tolerance(double tolerance);
+	double weld_tolerance() const { return m_vertex_welder.tolerance(); }
+
 	/** Adds unique vertices, halfedges and facets to m_halfedges, m_facets, and m_verts
 	 *  from the given triangle. */
 	void	add_triangle(const maths::triangle3d& t);
@@ -274,6 +334,7 @@ public:
 	const facet_iterator facets_end() const { return m_facets.end(); }
 
 	// Stuff for passing mesh to OpenGL VBOs
+	// (get_vbo_buffer() gives the same data in contiguous arrays, which is easier on the heap)
 	struct vbo_data_t
 	{
 		std::vector<double*> 		verts;		/**< 3 doubles per vertex */
@@ -292,6 +353,22 @@ public:
 
 	vbo_data_t get_vbo_data() const;
 
+	/** Returns the mesh as interleaved vertex positions and normals plus an index buffer,
+	 *  ready to upload to the GPU.  Vertices are in the same order as get_vertices().
+	 */
+	template <typename Real = float>
+	vbo_buffer<Real> get_vbo_buffer() const
+	{
+		vbo_buffer<Real> buffer;
+		buffer.indices = get_vertex_indices_();
+		buffer.vertex_data.resize(m_verts.size() * vbo_buffer<Real>::COMPONENTS_PER_VERTEX);
+
+		for (size_t v = 0 ; v < m_verts.size() ; v++)
+			buffer.set_vertex(v, m_verts[v]->get_point(), m_verts[v]->get_normal());
+
+		return buffer;
+	}
+
 	/** Returns true if there are no lamina halfedges in the tessellation */
 	bool is_manifold() const;
 
@@ -310,9 +387,10 @@ public:
 	friend std::ostream& operator<<(std::ostream& os, const triangle_mesh& mesh);
 };
 
-/** Output mesh as an ASCII STL to the given stream.
- *  @remark	This should probably eventually be replaced with a
- *  		mesh serializer class, if only to control binary or ASCII output.
+/** Output mesh as an ASCII STL to the given stream, formatted as stl_util::stl_exporter
+ *  does (shortest round-trip coordinates, the mesh name on the solid / endsolid lines).
+ *  Sets failbit on the stream if the STL can't be written, rather than throwing.
+ *  Use stl_util::stl_exporter directly for binary output.
  */
 std::ostream& operator<<(std::ostream& os, const triangle_mesh& mesh);
 
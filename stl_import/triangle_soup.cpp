@@ -0,0 +1,110 @@
+/*
+ * triangle_soup.cpp
+ */
+
+#include "triangle_soup.h"
+
+using std::vector;
+
+triangle_soup::triangle_soup(bool store_normals, bool store_attributes)
+: m_store_normals(store_normals)
+, m_store_attributes(store_attributes)
+{
+
+}
+
+void triangle_soup::reserve(size_t num_facets)
+{
+	m_x.reserve(3 * num_facets);
+	m_y.reserve(3 * num_facets);
+	m_z.reserve(3 * num_facets);
+
+	if (m_store_normals)
+	{
+		m_normal_x.reserve(num_facets);
+		m_normal_y.reserve(num_facets);
+		m_normal_z.reserve(num_facets);
+	}
+
+	if (m_store_attributes)
+		m_attributes.reserve(num_facets);
+}
+
+void triangle_soup::resize(size_t num_facets)
+{
+	m_x.resize(3 * num_facets);
+	m_y.resize(3 * num_facets);
+	m_z.resize(3 * num_facets);
+
+	if (m_store_normals)
+	{
+		m_normal_x.resize(num_facets);
+		m_normal_y.resize(num_facets);
+		m_normal_z.resize(num_facets);
+	}
+
+	if (m_store_attributes)
+		m_attributes.resize(num_facets);
+}
+
+void triangle_soup::clear()
+{
+	resize(0);
+	m_name.clear();
+}
+
+void triangle_soup::push_back(const maths::triangle3d& t)
+{
+	push_back(t, t.normal());
+}
+
+void triangle_soup::push_back(const maths::triangle3d& t, const maths::vector3d& normal, std::uint16_t attribute)
+{
+	const size_t f = size();
+	resize(f + 1);
+
+	set_triangle(f, t);
+	set_normal(f, normal);
+
+	if (m_store_attributes)
+		m_attributes[f] = attribute;
+}
+
+void triangle_soup::set_triangle(size_t f, const maths::triangle3d& t)
+{
+	for (size_t c = 0 ; c < 3 ; c++)
+	{
+		m_x[3 * f + c] = (float) t[c].x();
+		m_y[3 * f + c] = (float) t[c].y();
+		m_z[3 * f + c] = (float) t[c].z();
+	}
+}
+
+void triangle_soup::set_normal(size_t f, const maths::vector3d& normal)
+{
+	if (!m_store_normals)
+		return;
+
+	m_normal_x[f] = (float) normal.x();
+	m_normal_y[f] = (float) normal.y();
+	m_normal_z[f] = (float) normal.z();
+}
+
+maths::vector3d triangle_soup::get_normal(size_t f) const
+{
+	if (m_store_normals)
+		return maths::vector3d(m_normal_x[f], m_normal_y[f], m_normal_z[f]);
+
+	return get_triangle(f).normal();
+}
+
+vector<maths::triangle3d> triangle_soup::get_triangles() const
+{
+	vector<maths::triangle3d> triangles;
+	triangles.reserve(size());
+
+	for (size_t f = 0 ; f < size() ; f++)
+		triangles.push_back(get_triangle(f));
+
+	return triangles;
+}
@@ -0,0 +1,110 @@
+/*
+ * triangle_soup.h
+ *
+ * Unconnected triangles stored as structure-of-arrays, in single precision.
+ */
+
+#ifndef TRIANGLE_SOUP_H_
+#define TRIANGLE_SOUP_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "geom.h"
+
+/** A bunch of triangles with no connectivity, such as the facets of an STL.
+ *
+ *  Coordinates are kept as floats, which is all the precision a binary STL has,
+ *  in separate x, y and z arrays, so kernels can stream over each coordinate.
+ *  Corner c of facet f is at index 3f + c of each array.
+ *
+ *  Facet normals and attribute byte counts take up space only if the soup
+ *  was created to store them.
+ */
+class triangle_soup
+{
+private:
+	std::vector<float>			m_x;	// 3 per facet
+	std::vector<float>			m_y;
+	std::vector<float>			m_z;
+
+	std::vector<float>			m_normal_x;	// one per facet, if storing normals
+	std::vector<float>			m_normal_y;
+	std::vector<float>			m_normal_z;
+
+	std::vector<std::uint16_t>	m_attributes;	// one per facet, if storing attributes
+
+	bool						m_store_normals;
+	bool						m_store_attributes;
+
+	std::string					m_name;
+
+public:
+	explicit triangle_soup(bool store_normals = false, bool store_attributes = false);
+
+	size_t size() const { return m_x.size() / 3; }	// facets
+	bool empty() const { return m_x.empty(); }
+
+	bool has_normals() const { return m_store_normals; }
+	bool has_attributes() const { return m_store_attributes; }
+
+	void reserve(size_t num_facets);
+	void resize(size_t num_facets);
+	void clear();
+
+	void push_back(const maths::triangle3d& t);
+	void push_back(const maths::triangle3d& t, const maths::vector3d& normal, std::uint16_t attribute = 0);
+
+	/** Sets facet f from the 9 corner coordinates (x0, y0, z0, x1, ...) and 3 normal
+	 *  coordinates of a binary STL facet record.  The normal and attribute are
+	 *  dropped if the soup doesn't store them.
+	 */
+	void set_facet(size_t f, const float* corners, const float* normal, std::uint16_t attribute)
+	{
+		for (size_t c = 0 ; c < 3 ; c++)
+		{
+			m_x[3 * f + c] = corners[3 * c];
+			m_y[3 * f + c] = corners[3 * c + 1];
+			m_z[3 * f + c] = corners[3 * c + 2];
+		}
+
+		if (m_store_normals)
+		{
+			m_normal_x[f] = normal[0];
+			m_normal_y[f] = normal[1];
+			m_normal_z[f] = normal[2];
+		}
+
+		if (m_store_attributes)
+			m_attributes[f] = attribute;
+	}
+
+	void set_triangle(size_t f, const maths::triangle3d& t);
+	void set_normal(size_t f, const maths::vector3d& normal);	// no-op if not storing normals
+
+	maths::vector3d get_point(size_t f, size_t c) const { return maths::vector3d(m_x[3 * f + c], m_y[3 * f + c], m_z[3 * f + c]); }
+	maths::triangle3d get_triangle(size_t f) const { return maths::triangle3d(get_point(f, 0), get_point(f, 1), get_point(f, 2)); }
+	maths::vector3d get_normal(size_t f) const;		// the stored normal, or computed from the triangle if not storing normals
+	std::uint16_t get_attribute(size_t f) const { return m_store_attributes ? m_attributes[f] : 0; }
+
+	/** The facets as double precision triangles */
+	std::vector<maths::triangle3d> get_triangles() const;
+
+	/** @name Raw arrays
+	 *  The normal and attribute arrays are empty unless the soup stores them.
+	 *  @{ */
+	const float* x() const { return m_x.data(); }
+	const float* y() const { return m_y.data(); }
+	const float* z() const { return m_z.data(); }
+	const float* normal_x() const { return m_normal_x.data(); }
+	const float* normal_y() const { return m_normal_y.data(); }
+	const float* normal_z() const { return m_normal_z.data(); }
+	const std::uint16_t* attributes() const { return m_attributes.data(); }
+	/** @} */
+
+	std::string& name() { return m_name; }
+	const std::string& name() const { return m_name; }
+};
+
+#endif /* TRIANGLE_SOUP_H_ */
@@ -0,0 +1,60 @@
+/*
+ * vbo_buffer.h
+ *
+ * Mesh vertex and index data, laid out for uploading to GPU buffer objects.
+ */
+
+#ifndef VBO_BUFFER_H_
+#define VBO_BUFFER_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "geom.h"
+
+/** Vertex data and an index buffer for a mesh, in the layout that OpenGL (or any
+ *  other graphics API) expects, so both can be uploaded or written to disk as-is.
+ *
+ *  The position and normal of each vertex are interleaved: px, py, pz, nx, ny, nz.
+ *  Real is the component type, float unless double precision is wanted.
+ *  There are 3 indices per facet, in CCW order.
+ */
+template <typename Real = float>
+struct vbo_buffer
+{
+	static constexpr size_t COMPONENTS_PER_VERTEX = 6;
+	static constexpr size_t POSITION_OFFSET = 0;					// bytes
+	static constexpr size_t NORMAL_OFFSET = 3 * sizeof(Real);		// bytes
+	static constexpr size_t STRIDE = COMPONENTS_PER_VERTEX * sizeof(Real);	// bytes
+
+	std::vector<Real>			vertex_data;
+	std::vector<std::uint32_t>	indices;
+
+	size_t num_vertices() const { return vertex_data.size() / COMPONENTS_PER_VERTEX; }
+	size_t num_facets() const { return indices.size() / 3; }
+
+	void set_vertex(size_t v, const maths::vector3d& point, const maths::vector3d& normal)
+	{
+		Real* data = &vertex_data[v * COMPONENTS_PER_VERTEX];
+		for (size_t i = 0 ; i < 3 ; i++)
+		{
+			data[i] = (Real) point[i];
+			data[3 + i] = (Real) normal[i];
+		}
+	}
+
+	maths::vector3d get_point(size_t v) const
+	{
+		const Real* data = &vertex_data[v * COMPONENTS_PER_VERTEX];
+		return maths::vector3d(data[0], data[1], data[2]);
+	}
+
+	maths::vector3d get_normal(size_t v) const
+	{
+		const Real* data = &vertex_data[v * COMPONENTS_PER_VERTEX + 3];
+		return maths::vector3d(data[0], data[1], data[2]);
+	}
+};
+
+#endif /* VBO_BUFFER_H_ */
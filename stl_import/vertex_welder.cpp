@@ -0,0 +1,109 @@
+/*
+ * vertex_welder.cpp
+ */
+
+#include "vertex_welder.h"
+
+#include <cmath>
+#include <stdexcept>
+
+vertex_welder::vertex_welder(double tolerance)
+: m_tolerance(tolerance)
+{
+	if (!(tolerance >= 0.0))
+		throw std::invalid_argument("Weld tolerance must be non-negative");
+}
+
+vertex_welder::cell_t vertex_welder::get_cell_(const maths::vector3d& p) const
+{
+	cell_t cell;
+	cell.x = (std::int64_t) std::floor(p.x() / m_tolerance);
+	cell.y = (std::int64_t) std::floor(p.y() / m_tolerance);
+	cell.z = (std::int64_t) std::floor(p.z() / m_tolerance);
+
+	return cell;
+}
+
+std::pair<vertex_welder::index_t, bool> vertex_welder::weld(const maths::vector3d& p)
+{
+	const index_t new_vertex = (index_t) m_points.size();
+
+	if (m_tolerance == 0.0)
+	{
+		auto v = m_point_vertex.insert(p, new_vertex);
+		if (v.second)
+			m_points.push_back(p);
+
+		return std::make_pair(*v.first, v.second);
+	}
+
+	// Any vertex within tolerance has to be in this cell or one of its neighbors.
+	// Weld to the closest one.
+	const cell_t cell = get_cell_(p);
+	const double tol_sq = m_tolerance * m_tolerance;
+
+	index_t closest = NO_VERTEX;
+	double closest_dist_sq = tol_sq;
+
+	for (std::int64_t dx = -1 ; dx <= 1 ; dx++)
+	{
+		for (std::int64_t dy = -1 ; dy <= 1 ; dy++)
+		{
+			for (std::int64_t dz = -1 ; dz <= 1 ; dz++)
+			{
+				cell_t n_cell;
+				n_cell.x = cell.x + dx;
+				n_cell.y = cell.y + dy;
+				n_cell.z = cell.z + dz;
+
+				const index_t* cell_vertex = m_cell_vertex.find(n_cell);
+				for (index_t v = cell_vertex ? *cell_vertex : NO_VERTEX ; v != NO_VERTEX ; v = m_next_in_cell[v])
+				{
+					const double dist_sq = m_points[v].distance_sq(p);
+					if (dist_sq < closest_dist_sq || (dist_sq == closest_dist_sq && v < closest))
+					{
+						closest = v;
+						closest_dist_sq = dist_sq;
+					}
+				}
+			}
+		}
+	}
+
+	if (closest != NO_VERTEX)
+		return std::make_pair(closest, false);
+
+	// Add a new vertex to the front of its cell's list
+	m_points.push_back(p);
+
+	auto cell_vertex = m_cell_vertex.insert(cell, new_vertex);
+	m_next_in_cell.push_back(cell_vertex.second ? NO_VERTEX : *cell_vertex.first);
+	*cell_vertex.first = new_vertex;
+
+	return std::make_pair(new_vertex, true);
+}
+
+void vertex_welder::reserve(size_t num_vertices)
+{
+	m_points.reserve(num_vertices);
+
+	if (m_tolerance == 0.0)
+	{
+		m_point_vertex.reserve(num_vertices);
+	}
+	else
+	{
+		m_cell_vertex.reserve(num_vertices);
+		m_next_in_cell.reserve(num_vertices);
+	}
+}
+
+void vertex_welder::clear()
+{
+	m_points.clear();
+	m_points.shrink_to_fit();
+	m_point_vertex.clear();
+	m_cell_vertex.clear();
+	m_next_in_cell.clear();
+	m_next_in_cell.shrink_to_fit();
+}
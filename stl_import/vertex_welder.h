@@ -0,0 +1,79 @@
+/*
+ * vertex_welder.h
+ *
+ * Merges coincident (or nearly coincident) points into shared vertices
+ * when building meshes.
+ */
+
+#ifndef VERTEX_WELDER_H_
+#define VERTEX_WELDER_H_
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include "geom.h"
+#include "open_hash_map.h"
+
+/** Assigns a vertex index to each point that it is given, so that points
+ *  within tolerance of an existing vertex get that vertex's index.
+ *
+ *  With a tolerance of 0, only identical points are welded, using a hash of the points.
+ *  Otherwise, vertices are bucketed in a hash grid with cells tolerance wide, so
+ *  each point only has to be checked against the vertices in the neighboring cells.
+ *  A vertex stays where its first point was.
+ */
+class vertex_welder
+{
+public:
+	typedef std::uint32_t index_t;
+
+private:
+	struct cell_t
+	{
+		std::int64_t	x = 0;
+		std::int64_t	y = 0;
+		std::int64_t	z = 0;
+
+		bool operator==(const cell_t& c) const { return x == c.x && y == c.y && z == c.z; }
+	};
+
+	struct cell_hash
+	{
+		std::uint64_t operator()(const cell_t& c) const
+		{
+			return ((std::uint64_t) c.x * 0x9e3779b97f4a7c15ULL) ^ ((std::uint64_t) c.y * 0xc2b2ae3d27d4eb4fULL) ^ (std::uint64_t) c.z;
+		}
+	};
+
+	static constexpr index_t NO_VERTEX = ~index_t(0);
+
+	double									m_tolerance;
+	std::vector<maths::vector3d>			m_points;			// one per vertex
+
+	open_hash_map<maths::vector3d, index_t, point_hash>	m_point_vertex;	// when m_tolerance == 0
+
+	open_hash_map<cell_t, index_t, cell_hash>	m_cell_vertex;		// the most recently added vertex in each cell
+	std::vector<index_t>						m_next_in_cell;		// one per vertex, NO_VERTEX at the end of the cell
+
+	cell_t	get_cell_(const maths::vector3d& p) const;
+
+public:
+	vertex_welder(double tolerance = 0.0);
+
+	double tolerance() const { return m_tolerance; }
+
+	/** Returns the index of the vertex that p welds to, adding a new vertex at p if
+	 *  there isn't one within tolerance.  The second element of the returned pair is
+	 *  true if a new vertex was added.
+	 */
+	std::pair<index_t, bool> weld(const maths::vector3d& p);
+
+	const maths::vector3d& get_point(index_t v) const { return m_points[v]; }
+	size_t size() const { return m_points.size(); }
+
+	void reserve(size_t num_vertices);
+	void clear();
+};
+
+#endif /* VERTEX_WELDER_H_ */
@@ -0,0 +1,553 @@
+#include "stl_importer.h"
+#include "stl_exporter.h"
+#include "triangle_mesh.h"
+#include "compact_mesh.h"
+#include "mesh_import.h"
+#include "compact_mesh_file.h"
+#include "mesh_cache.h"
+
+#include <tut.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/param.h>
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+extern std::string g_test_data_path;
+
+namespace tut
+{
+
+struct compact_mesh_test_data
+{
+	const std::string& test_data_path() const { return g_test_data_path; }
+
+	std::vector<maths::triangle3d> import_triangles(const std::string& stl_file) const
+	{
+		stl_util::stl_importer importer(test_data_path() + stl_file);
+
+		std::vector<maths::triangle3d> triangles;
+		importer.import(back_inserter(triangles));
+
+		return triangles;
+	}
+};
+
+typedef test_group<compact_mesh_test_data> compact_mesh_test_t;
+compact_mesh_test_t compact_mesh_tests("compact_mesh tests");
+
+template <> template <>
+void compact_mesh_test_t::object::test<1>()
+{
+	set_test_name("Sphere topology");
+
+	compact_mesh mesh(import_triangles("/sphere.stl"));
+
+	ensure_equals(mesh.num_halfedges(), 864);
+	ensure_equals(mesh.num_vertices(), 146);
+	ensure_equals(mesh.num_facets(), 288);
+	ensure(mesh.is_manifold());
+	ensure(mesh.get_lamina_halfedges().empty());
+
+	for (compact_mesh::index_t he = 0 ; he < mesh.num_halfedges() ; he++)
+	{
+		const compact_mesh::index_t sym = mesh.get_sym_halfedge(he);
+
+		ensure_equals(mesh.get_sym_halfedge(sym), he);
+		ensure_equals(mesh.get_start_vertex(sym), mesh.get_end_vertex(he));
+		ensure_equals(mesh.get_end_vertex(sym), mesh.get_start_vertex(he));
+		ensure(mesh.get_facet(sym) != mesh.get_facet(he));
+
+		ensure_equals(mesh.get_next_halfedge(mesh.get_prev_halfedge(he)), he);
+		ensure_equals(mesh.get_facet(mesh.get_next_halfedge(he)), mesh.get_facet(he));
+	}
+
+	for (compact_mesh::index_t v = 0 ; v < mesh.num_vertices() ; v++)
+	{
+		for (compact_mesh::index_t he : mesh.get_adjacent_halfedges(v))
+			ensure_equals(mesh.get_start_vertex(he), v);
+	}
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<2>()
+{
+	set_test_name("Matches triangle_mesh");
+
+	for (const string stl_file : { "/sphere.stl", "/unit_sphere-ascii.stl", "/bottle.stl", "/DNA_L.stl" })
+	{
+		const std::vector<maths::triangle3d> triangles = import_triangles(stl_file);
+
+		triangle_mesh mesh;
+		mesh.build(triangles);
+
+		compact_mesh c_mesh(triangles);
+
+		ensure_equals(c_mesh.num_halfedges(), mesh.get_halfedges().size());
+		ensure_equals(c_mesh.num_vertices(), mesh.get_vertices().size());
+		ensure_equals(c_mesh.num_facets(), mesh.get_facets().size());
+		ensure_equals(c_mesh.is_manifold(), mesh.is_manifold());
+		ensure_equals(c_mesh.get_lamina_halfedges().size(), mesh.get_lamina_halfedges().size());
+
+		ensure_distance(c_mesh.area(), mesh.area(), 1.0e-8 * mesh.area());
+		ensure_distance(c_mesh.volume(), mesh.volume(), 1.0e-8 * mesh.volume());
+
+		// Vertices are created in the same order
+		for (size_t v = 0 ; v < c_mesh.num_vertices() ; v++)
+			ensure(c_mesh.get_point(v) == mesh.get_vertices()[v]->get_point());
+
+		// triangle_mesh stops walking around a vertex at the first lamina halfedge, so only
+		// closed meshes get the same vertex normals
+		const vbo_buffer<double> c_buffer = c_mesh.get_vbo_buffer<double>();
+		const vbo_buffer<double> buffer = mesh.get_vbo_buffer<double>();
+		if (mesh.is_manifold())
+			ensure(c_buffer.vertex_data == buffer.vertex_data);
+		ensure(c_buffer.indices == c_mesh.get_indices());
+	}
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<3>()
+{
+	set_test_name("Weld tolerance");
+
+	// Nudge every corner of the sphere's triangles a little, so that the
+	// corners of neighboring triangles don't quite match up any more
+	std::vector<maths::triangle3d> triangles = import_triangles("/sphere.stl");
+	for (size_t i = 0 ; i < triangles.size() ; i++)
+	{
+		maths::vector3d corners[3];
+		for (size_t j = 0 ; j < 3 ; j++)
+		{
+			const double jitter = 1.0e-9 * (double) ((3 * i + j) % 7 + 1);
+			corners[j] = triangles[i][j] + maths::vector3d(jitter, -jitter, jitter);
+		}
+
+		triangles[i] = maths::triangle3d(corners[0], corners[1], corners[2]);
+	}
+
+	// ... plus a sliver that collapses when it is welded
+	triangles.push_back(maths::triangle3d(triangles[0][0], triangles[0][1], triangles[0][1] + maths::vector3d(1.0e-9, 0.0, 0.0)));
+
+	compact_mesh exact_mesh(triangles);
+	ensure(!exact_mesh.is_manifold());
+	ensure(exact_mesh.num_vertices() > 146);
+
+	compact_mesh c_mesh;
+	c_mesh.set_weld_tolerance(1.0e-6);
+	c_mesh.build(triangles);
+
+	ensure_equals(c_mesh.num_vertices(), 146);
+	ensure_equals(c_mesh.num_facets(), 288);
+	ensure(c_mesh.is_manifold());
+
+	triangle_mesh mesh;
+	mesh.set_weld_tolerance(1.0e-6);
+	mesh.build(triangles, 4);
+
+	ensure_equals(mesh.get_vertices().size(), 146);
+	ensure_equals(mesh.get_facets().size(), 288);
+	ensure(mesh.is_manifold());
+
+	// Vertices stay where they were first seen
+	for (size_t v = 0 ; v < c_mesh.num_vertices() ; v++)
+		ensure(c_mesh.get_point(v) == mesh.get_vertices()[v]->get_point());
+
+	try
+	{
+		c_mesh.set_weld_tolerance(-1.0);
+		fail("Negative weld tolerance accepted");
+	}
+	catch (const std::invalid_argument&)
+	{
+	}
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<4>()
+{
+	set_test_name("Streaming import");
+
+	for (const string stl_file : { "/unit_sphere-ascii.stl", "/bottle.stl", "/DNA_L.stl" })
+	{
+		const compact_mesh expected_mesh(import_triangles(stl_file));
+
+		for (auto count_mode : { stl_util::facet_count_mode::exact, stl_util::facet_count_mode::estimate })
+		{
+			stl_util::stl_importer importer(test_data_path() + stl_file, count_mode);
+
+			compact_mesh mesh;
+			stl_util::import_compact_mesh(importer, mesh);
+
+			ensure_equals(importer.num_facets_read(), expected_mesh.num_facets());
+			ensure_equals(mesh.name(), importer.name());
+
+			ensure(mesh.get_points() == expected_mesh.get_points());
+			ensure(mesh.get_indices() == expected_mesh.get_indices());
+			ensure(mesh.get_sym_halfedges() == expected_mesh.get_sym_halfedges());
+		}
+	}
+
+	// Too short to have a header
+	try
+	{
+		stl_util::stl_importer importer(make_shared<std::istringstream>(string(60, '\x01')));
+
+		compact_mesh mesh;
+		stl_util::import_compact_mesh(importer, mesh);
+		fail("Imported a binary STL without a header");
+	}
+	catch (std::runtime_error&)
+	{
+	}
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<5>()
+{
+	set_test_name("Surface properties");
+
+	for (const string stl_file : { "/unit_cube.stl", "/sphere.stl", "/bottle.stl", "/DNA_L.stl" })
+	{
+		const std::vector<maths::triangle3d> triangles = import_triangles(stl_file);
+
+		// Straightforward one triangle at a time sums to check against
+		double area = 0.0, signed_volume = 0.0;
+		maths::vector3d weighted_centroid;
+		for (const auto& t : triangles)
+		{
+			area += t.area();
+			signed_volume += t.signed_volume();
+			weighted_centroid += (t[0] + t[1] + t[2]) * (t.area() / 3.0);
+		}
+
+		const maths::vector3d centroid = weighted_centroid / area;
+
+		compact_mesh mesh(triangles);
+		const surface_properties props = mesh.get_surface_properties();
+
+		ensure_distance(props.area, area, 1.0e-10 * area);
+		ensure_distance(props.signed_volume, signed_volume, 1.0e-10 * std::abs(signed_volume) + 1.0e-12);
+		ensure(props.centroid.is_close(centroid, 1.0e-8 * std::sqrt(area)));
+		ensure(props.bbox.min() == mesh.bbox().min());
+		ensure(props.bbox.max() == mesh.bbox().max());
+
+		ensure_equals(mesh.area(), props.area);
+		ensure_equals(mesh.volume(), props.volume());
+
+		// The soup is single precision
+		triangle_soup soup;
+		for (const auto& t : triangles)
+			soup.push_back(t);
+
+		const surface_properties soup_props = compute_surface_properties(soup);
+
+		ensure_distance(soup_props.area, area, 1.0e-5 * area);
+		ensure_distance(soup_props.signed_volume, signed_volume, 1.0e-5 * std::abs(signed_volume) + 1.0e-8);
+		ensure(soup_props.centroid.is_close(centroid, 1.0e-5 * std::sqrt(area)));
+	}
+
+	ensure_equals(compute_surface_properties(triangle_soup()).area, 0.0);
+	ensure(compute_surface_properties(triangle_soup()).bbox.is_empty());
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<6>()
+{
+	set_test_name("Save and load");
+
+	const string filename = (std::filesystem::temp_directory_path() / "compact_mesh_test.cmesh").string();
+
+	for (const string stl_file : { "/sphere.stl", "/bottle.stl", "/DNA_L.stl" })
+	{
+		compact_mesh mesh(import_triangles(stl_file));
+		mesh.name() = stl_file;
+
+		stl_util::save_compact_mesh(mesh, filename);
+
+		// Straight out of the mapping...
+		{
+			stl_util::mapped_compact_mesh mapped_mesh(filename);
+
+			ensure_equals(mapped_mesh.num_vertices(), mesh.num_vertices());
+			ensure_equals(mapped_mesh.num_facets(), mesh.num_facets());
+			ensure_equals(mapped_mesh.name(), stl_file);
+
+			for (compact_mesh::index_t v = 0 ; v < mesh.num_vertices() ; v++)
+			{
+				ensure(mapped_mesh.get_point(v) == mesh.get_point(v));
+				ensure_equals(mapped_mesh.vertex_halfedges()[v], mesh.get_vertex_halfedge(v));
+			}
+
+			ensure(std::equal(mesh.get_indices().begin(), mesh.get_indices().end(), mapped_mesh.indices()));
+			ensure(std::equal(mesh.get_sym_halfedges().begin(), mesh.get_sym_halfedges().end(), mapped_mesh.sym_halfedges()));
+
+			// The queries work on the mapping just as they do on the mesh
+			for (compact_mesh::index_t v = 0 ; v < mesh.num_vertices() ; v++)
+			{
+				ensure(mapped_mesh.get_adjacent_halfedges(v) == mesh.get_adjacent_halfedges(v));
+				ensure(mapped_mesh.get_vertex_adjacent_facets(v) == mesh.get_vertex_adjacent_facets(v));
+				ensure(mapped_mesh.get_vertex_normal(v) == mesh.get_vertex_normal(v));
+			}
+
+			for (compact_mesh::index_t f = 0 ; f < mesh.num_facets() ; f++)
+			{
+				ensure(mapped_mesh.get_adjacent_facets(f) == mesh.get_adjacent_facets(f));
+				ensure(mapped_mesh.get_facet_normal(f) == mesh.get_facet_normal(f));
+				for (size_t i = 0 ; i < 3 ; i++)
+					ensure(mapped_mesh.get_triangle(f)[i] == mesh.get_triangle(f)[i]);
+			}
+		}
+
+		// ...and loaded back into a mesh
+		compact_mesh loaded_mesh;
+		stl_util::load_compact_mesh(filename, loaded_mesh);
+
+		ensure_equals(loaded_mesh.name(), mesh.name());
+		ensure(loaded_mesh.get_points() == mesh.get_points());
+		ensure(loaded_mesh.get_vertex_halfedges() == mesh.get_vertex_halfedges());
+		ensure(loaded_mesh.get_indices() == mesh.get_indices());
+		ensure(loaded_mesh.get_sym_halfedges() == mesh.get_sym_halfedges());
+		ensure(loaded_mesh.get_facet_normals() == mesh.get_facet_normals());
+		ensure_equals(loaded_mesh.is_manifold(), mesh.is_manifold());
+		ensure_equals(loaded_mesh.volume(), mesh.volume());
+	}
+
+	// Truncated, corrupt and not a mesh at all
+	std::ostringstream mesh_stream;
+	stl_util::save_compact_mesh(compact_mesh(import_triangles("/sphere.stl")), mesh_stream);
+	const string mesh_str = mesh_stream.str();
+
+	string corrupt_str = mesh_str;
+	std::memset(&corrupt_str[mesh_str.size() / 2], 0x7f, 64);	// somewhere in the topology
+
+	// Written on a machine with the other byte order, which is what to report whatever the version says
+	string swapped_str = mesh_str;
+	std::reverse(&swapped_str[8], &swapped_str[12]);
+	std::reverse(&swapped_str[12], &swapped_str[16]);
+	std::ofstream(filename, std::ios::binary) << swapped_str;
+
+	try
+	{
+		stl_util::mapped_compact_mesh swapped_mesh(filename);
+		fail("Loaded a compact mesh file with the wrong byte order");
+	}
+	catch (std::runtime_error& e)
+	{
+		ensure_equals(string(e.what()), "Compact mesh file was written with a different byte order");
+	}
+
+	for (const string& bad_str : { mesh_str.substr(0, mesh_str.size() - 1), corrupt_str, string("solid x\n"), string() })
+	{
+		std::ofstream(filename, std::ios::binary) << bad_str;
+
+		try
+		{
+			compact_mesh bad_mesh;
+			stl_util::load_compact_mesh(filename, bad_mesh);
+			fail("Loaded a bad compact mesh file");
+		}
+		catch (std::runtime_error&)
+		{
+		}
+	}
+
+	std::filesystem::remove(filename);
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<7>()
+{
+	set_test_name("Mesh cache");
+
+	const std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "compact_mesh_cache_test";
+	std::filesystem::remove_all(temp_dir);
+	std::filesystem::create_directories(temp_dir);
+
+	const string stl_filename = (temp_dir / "part.stl").string();
+	const string copy_filename = (temp_dir / "copy.stl").string();
+	std::filesystem::copy_file(test_data_path() + "/sphere.stl", stl_filename);
+	std::filesystem::copy_file(test_data_path() + "/sphere.stl", copy_filename);
+
+	stl_util::mesh_cache cache((temp_dir / "cache").string());
+	ensure_equals(cache.size(), 0u);
+
+	const compact_mesh expected_mesh(import_triangles("/sphere.stl"));
+
+	auto ensure_same_mesh = [&](const compact_mesh& mesh, const compact_mesh& expected)
+	{
+		ensure(mesh.get_points() == expected.get_points());
+		ensure(mesh.get_indices() == expected.get_indices());
+		ensure(mesh.get_sym_halfedges() == expected.get_sym_halfedges());
+		ensure(mesh.get_vertex_halfedges() == expected.get_vertex_halfedges());
+	};
+
+	// Built the first time, then from the cache, including under another name
+	compact_mesh mesh;
+	ensure(!cache.get_mesh(stl_filename, mesh));
+	ensure_same_mesh(mesh, expected_mesh);
+	ensure(cache.size() > 0);
+
+	for (const string& filename : { stl_filename, copy_filename, stl_filename })
+	{
+		compact_mesh cached_mesh;
+		ensure(cache.get_mesh(filename, cached_mesh));
+		ensure_same_mesh(cached_mesh, expected_mesh);
+		ensure_equals(cached_mesh.name(), mesh.name());
+	}
+
+	// A different weld tolerance is a different mesh
+	compact_mesh welded_mesh;
+	welded_mesh.set_weld_tolerance(1e-3);
+	ensure(!cache.get_mesh(stl_filename, welded_mesh));
+	ensure(cache.get_mesh(stl_filename, welded_mesh));
+	ensure_equals(welded_mesh.weld_tolerance(), 1e-3);
+
+	auto read_file = [](const string& filename)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		return string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	};
+
+	auto hash_prefix = [](const string& contents)
+	{
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) stl_util::mesh_cache::hash_bytes(contents.data(), contents.size()));
+		return string(hex);
+	};
+
+	// Editing the file in place, even without changing its size, means it's read again
+	{
+		string contents = read_file(stl_filename);
+		const size_t vertex_pos = contents.find("vertex 1");
+		ensure(vertex_pos != string::npos);
+		contents[vertex_pos + 7] = '2';
+
+		const std::filesystem::file_time_type mtime = std::filesystem::last_write_time(stl_filename);
+		std::ofstream(stl_filename, std::ios::binary | std::ios::trunc) << contents;
+		std::filesystem::last_write_time(stl_filename, mtime + std::chrono::seconds(1));
+
+		stl_util::stl_importer importer(stl_filename);
+		std::vector<maths::triangle3d> edited_triangles;
+		importer.import(back_inserter(edited_triangles));
+		const compact_mesh edited_mesh(edited_triangles);
+
+		compact_mesh cached_mesh;
+		ensure(!cache.get_mesh(stl_filename, cached_mesh));
+		ensure_same_mesh(cached_mesh, edited_mesh);
+		ensure(cache.get_mesh(stl_filename, cached_mesh));
+		ensure_same_mesh(cached_mesh, edited_mesh);
+	}
+
+	// Two STLs whose contents hash the same still don't share a mesh unless they're the same size too.
+	// Fake a collision by giving the sphere's mesh the name the cube's mesh would have.
+	{
+		const string cube_filename = (temp_dir / "cube.stl").string();
+		std::filesystem::copy_file(test_data_path() + "/unit_cube.stl", cube_filename);
+
+		const string sphere_prefix = hash_prefix(read_file(copy_filename));
+		const string cube_prefix = hash_prefix(read_file(cube_filename));
+
+		for (const auto& entry : std::filesystem::directory_iterator(temp_dir / "cache"))
+		{
+			const string name = entry.path().filename().string();
+			if (entry.path().extension() == ".cmesh" && name.compare(0, sphere_prefix.size(), sphere_prefix) == 0)
+				std::filesystem::copy_file(entry.path(), temp_dir / "cache" / (cube_prefix + name.substr(sphere_prefix.size())));
+		}
+
+		compact_mesh cube_mesh;
+		ensure(!cache.get_mesh(cube_filename, cube_mesh));
+		ensure_same_mesh(cube_mesh, compact_mesh(import_triangles("/unit_cube.stl")));
+	}
+
+	// Changing the file changes its key
+	std::filesystem::copy_file(test_data_path() + "/bottle.stl", stl_filename, std::filesystem::copy_options::overwrite_existing);
+	const compact_mesh bottle_mesh(import_triangles("/bottle.stl"));
+
+	compact_mesh changed_mesh;
+	ensure(!cache.get_mesh(stl_filename, changed_mesh));
+	ensure_same_mesh(changed_mesh, bottle_mesh);
+
+	// A corrupt entry is just a miss
+	for (const auto& entry : std::filesystem::directory_iterator(temp_dir / "cache"))
+	{
+		if (entry.path().extension() == ".cmesh")
+			std::filesystem::resize_file(entry.path(), entry.file_size() / 2);
+	}
+
+	ensure(!cache.get_mesh(copy_filename, mesh));
+	ensure_same_mesh(mesh, expected_mesh);
+	ensure(cache.get_mesh(copy_filename, mesh));
+
+	// Trimming drops the least recently used entries
+	const std::uint64_t full_size = cache.size();
+	cache.set_max_size(full_size / 2);
+	cache.trim();
+	ensure(cache.size() <= full_size / 2);
+	ensure(cache.get_mesh(copy_filename, mesh));	// the last one used is still there
+
+	cache.clear();
+	ensure_equals(cache.size(), 0u);
+
+	std::filesystem::remove_all(temp_dir);
+}
+
+template <> template <>
+void compact_mesh_test_t::object::test<8>()
+{
+	set_test_name("Vertex adjacency on an open patch");
+
+	// A flat 3x3 grid of squares split into triangles, so the vertices around the
+	// edge only have part of a fan of facets around them
+	std::vector<maths::triangle3d> triangles;
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		for (int j = 0 ; j < 3 ; j++)
+		{
+			const maths::vector3d p00(i, j, 0), p10(i + 1, j, 0), p01(i, j + 1, 0), p11(i + 1, j + 1, 0);
+			triangles.push_back(maths::triangle3d(p00, p10, p11));
+			triangles.push_back(maths::triangle3d(p00, p11, p01));
+		}
+	}
+
+	compact_mesh mesh(triangles);
+	ensure_equals(mesh.num_vertices(), 16);
+	ensure(!mesh.is_manifold());
+
+	for (compact_mesh::index_t v = 0 ; v < mesh.num_vertices() ; v++)
+	{
+		std::vector<compact_mesh::index_t> expected_facets;
+		for (compact_mesh::index_t f = 0 ; f < mesh.num_facets() ; f++)
+		{
+			for (compact_mesh::index_t i = 0 ; i < 3 ; i++)
+			{
+				if (mesh.get_start_vertex(mesh.get_facet_halfedge(f) + i) == v)
+					expected_facets.push_back(f);
+			}
+		}
+
+		const std::vector<compact_mesh::index_t> halfedges = mesh.get_adjacent_halfedges(v);
+		ensure_equals(halfedges.size(), expected_facets.size());
+		for (compact_mesh::index_t he : halfedges)
+			ensure_equals(mesh.get_start_vertex(he), v);
+
+		std::vector<compact_mesh::index_t> facets = mesh.get_vertex_adjacent_facets(v);
+		std::sort(facets.begin(), facets.end());
+		ensure(facets == expected_facets);
+
+		// Every facet's normal is straight up, wherever the vertex is
+		ensure(mesh.get_vertex_normal(v) == maths::vector3d(0, 0, 1));
+	}
+}
+
+};
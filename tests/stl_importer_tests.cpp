@@ -1,5 +1,9 @@
 #include "stl_importer.h"
+#include "stl_exporter.h"
+#include "stl_generator.h"
+#include "compact_mesh.h"
 #include "triangle_mesh.h"
+#include "mesh_import.h"
 
 #include <tut.h>
 
@@ -9,6 +13,11 @@
 #include <sys/param.h>
 #include <math.h>
 
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
 using namespace std;
 
 extern std::string g_test_data_path;
@@ -16,6 +25,26 @@ extern std::string g_test_data_path;
 namespace tut
 {
 
+/** An istream that can't seek, like a pipe */
+class forward_only_istream : public std::istream
+{
+private:
+	class forward_only_stringbuf : public std::stringbuf
+	{
+	public:
+		forward_only_stringbuf(const string& s) : std::stringbuf(s, std::ios::in) { }
+
+	protected:
+		pos_type seekoff(off_type, std::ios::seekdir, std::ios::openmode) override { return pos_type(off_type(-1)); }
+		pos_type seekpos(pos_type, std::ios::openmode) override { return pos_type(off_type(-1)); }
+	};
+
+	forward_only_stringbuf	m_buf;
+
+public:
+	forward_only_istream(const string& s) : std::istream(nullptr), m_buf(s) { rdbuf(&m_buf); }
+};
+
 struct stl_importer_test_data
 {
 	stl_importer_test_data()
@@ -61,6 +90,18 @@ struct stl_importer_test_data
 
 		return stl_ss.str();
 	}
+
+	/** A binary STL of the given triangles whose header claims four billion facets */
+	static string get_bad_facet_count_stl_str(const std::vector<maths::triangle3d>& triangles)
+	{
+		std::ostringstream stl_stream;
+		stl_util::stl_exporter(stl_stream, stl_util::stl_format::binary).write(triangles, "bad count");
+
+		string stl_str = stl_stream.str();
+		std::memset(&stl_str[80], 0xff, 4);
+
+		return stl_str;
+	}
 };
 
 typedef test_group<stl_importer_test_data> stl_importer_test_t;
@@ -129,4 +170,977 @@ void stl_importer_test_t::object::test<4>()
 	ensure(stl_triangles.size() == num_facets_expected);
 }
 
+template <> template <>
+void stl_importer_test_t::object::test<5>()
+{
+	set_test_name("Mapped binary STL");
+
+	const std::string file_path = test_data_path() + "/unit_cube.stl";
+
+	// Importing from a file name decodes straight out of a mapping of the file
+	stl_util::stl_importer mapped_importer(file_path);
+
+	std::vector<maths::triangle3d> mapped_triangles;
+	mapped_importer.import(back_inserter(mapped_triangles));
+
+	auto stl_ifstream = make_shared<ifstream>(file_path, std::ifstream::binary);
+	stl_util::stl_importer stream_importer(stl_ifstream);
+
+	std::vector<maths::triangle3d> stream_triangles;
+	stream_importer.import(back_inserter(stream_triangles));
+
+	ensure_equals(mapped_importer.name(), stream_importer.name());
+	ensure_equals(mapped_importer.num_facets_expected(), stream_importer.num_facets_expected());
+	ensure(mapped_triangles.size() == 12);
+	ensure(mapped_triangles.size() == stream_triangles.size());
+
+	for (size_t i = 0 ; i < mapped_triangles.size() ; i++)
+	{
+		for (size_t j = 0 ; j < 3 ; j++)
+			ensure(mapped_triangles[i][j] == stream_triangles[i][j]);
+	}
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<6>()
+{
+	set_test_name("Batch facet reading");
+
+	istringstream tet_is(get_tetrahedron_stl_str());
+	stl_util::ascii_stl_reader reader(tet_is);
+
+	string name;
+	ensure(reader.read_header(name));
+	ensure_equals(name, "test_tetrahedron");
+
+	// Ask for fewer facets than there are in the file
+	std::vector<maths::triangle3d> triangles(3);
+	std::vector<maths::vector3d> normals(3);
+	ensure_equals(reader.read_facets(triangles.data(), normals.data(), 3), 3);
+	ensure(!reader.done());
+
+	ensure(normals[1].is_close(maths::vector3d(-0.84016805, 0.48507125, 0.24253563), 1.0e-8));
+	ensure(triangles[2][2].is_close(maths::vector3d(0.5, -0.4330127, 0.0), 1.0e-8));
+
+	// ...then more than are left
+	ensure_equals(reader.read_facets(triangles.data(), nullptr, 3), 1);
+	ensure(reader.done());
+	ensure(triangles[0][0].is_close(maths::vector3d(0.5, -0.4330127, 0.0), 1.0e-8));
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<7>()
+{
+	set_test_name("ASCII keywords, line endings and bad facets");
+
+	ostringstream stl_ss;
+	stl_ss << "SOLID Mixed Case\r\n";
+	stl_ss << "  FACET Normal 0 0 +1\r\n";
+	stl_ss << "\tOuter\tLoop\r\n";
+	stl_ss << "\r\n";	// blank lines are ignored
+	stl_ss << "    VERTEX 0 0 0\r\n";
+	stl_ss << "    Vertex 1.0E+00 0 0\r\n";
+	stl_ss << "    vertex 0 1e0 0\r\n";
+	stl_ss << "  EndLoop\r\n";
+	stl_ss << "  ENDFACET\r\n";
+	stl_ss << "  facet normal 0 0 1\n";	// bad vertex, this facet is skipped
+	stl_ss << "    outer loop\n";
+	stl_ss << "      vertex 0 0 zero\n";
+	stl_ss << "      vertex 1 0 0\n";
+	stl_ss << "      vertex 0 1 0\n";
+	stl_ss << "    endloop\n";
+	stl_ss << "  endfacet\n";
+	stl_ss << "  facet normal 0 0 1\n";
+	stl_ss << "    outer loop\n";
+	stl_ss << "      vertex 1 1 0\n";
+	stl_ss << "      vertex 0 1 0\n";
+	stl_ss << "      vertex 1 0 0\n";
+	stl_ss << "    endloop\n";
+	stl_ss << "  endfacet\n";
+	stl_ss << "endsolid";	// no trailing newline
+
+	auto ss = make_shared<istringstream>(stl_ss.str());
+	stl_util::stl_importer importer(ss);
+	ensure_equals(importer.num_facets_expected(), 3);
+
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	ensure_equals(importer.name(), "Mixed Case");
+	ensure_equals(stl_triangles.size(), 2);
+	ensure(stl_triangles[0][1] == maths::vector3d(1, 0, 0));
+	ensure(stl_triangles[0][2] == maths::vector3d(0, 1, 0));
+	ensure(stl_triangles[1][0] == maths::vector3d(1, 1, 0));
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<8>()
+{
+	set_test_name("Multi-threaded ASCII import");
+
+	for (const string stl_file : { "/DNA_L.stl", "/unit_sphere-ascii.stl", "/humanoid.stl" })
+	{
+		const std::string file_path = test_data_path() + stl_file;
+
+		stl_util::stl_importer importer(file_path);
+
+		std::vector<maths::triangle3d> stl_triangles;
+		importer.import(back_inserter(stl_triangles));
+
+		// From a mapped file
+		stl_util::stl_importer mt_importer(file_path);
+		mt_importer.set_num_threads(4);
+
+		std::vector<maths::triangle3d> mt_triangles;
+		mt_importer.import(back_inserter(mt_triangles));
+
+		// From a stream
+		auto stl_ifstream = make_shared<ifstream>(file_path, std::ifstream::binary);
+		stl_util::stl_importer mt_stream_importer(stl_ifstream);
+		mt_stream_importer.set_num_threads(3);
+
+		std::vector<maths::triangle3d> mt_stream_triangles;
+		mt_stream_importer.import(back_inserter(mt_stream_triangles));
+
+		ensure(!stl_triangles.empty());
+		ensure_equals(mt_importer.name(), importer.name());
+		ensure_equals(mt_stream_importer.name(), importer.name());
+		ensure_equals(mt_importer.num_facets_read(), stl_triangles.size());
+		ensure_equals(mt_triangles.size(), stl_triangles.size());
+		ensure_equals(mt_stream_triangles.size(), stl_triangles.size());
+
+		// Facets should come out in file order
+		for (size_t i = 0 ; i < stl_triangles.size() ; i++)
+		{
+			for (size_t j = 0 ; j < 3 ; j++)
+			{
+				ensure(mt_triangles[i][j] == stl_triangles[i][j]);
+				ensure(mt_stream_triangles[i][j] == stl_triangles[i][j]);
+			}
+		}
+	}
+
+	// Looks like ASCII, but there's no "solid" to be found, which is the same error however it's read
+	for (unsigned num_threads : { 1, 4 })
+	{
+		stl_util::stl_importer bad_importer(make_shared<std::istringstream>(
+			"solidified\nfacet normal 0 0 1\n outer loop\n  vertex 0 0 0\n  vertex 1 0 0\n  vertex 0 1 0\n endloop\nendfacet\n"));
+		bad_importer.set_num_threads(num_threads);
+
+		try
+		{
+			std::vector<maths::triangle3d> bad_triangles;
+			bad_importer.import(back_inserter(bad_triangles));
+			fail("Imported an ASCII STL without a header");
+		}
+		catch (std::runtime_error& e)
+		{
+			ensure_equals(string(e.what()), "Error reading STL header");
+		}
+	}
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<9>()
+{
+	set_test_name("Multi-threaded binary import");
+
+	const std::string file_path = test_data_path() + "/unit_cube.stl";
+
+	stl_util::stl_importer importer(file_path);
+
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	for (unsigned num_threads : { 2, 5, 16 })
+	{
+		stl_util::stl_importer mt_importer(file_path);
+		mt_importer.set_num_threads(num_threads);
+
+		std::vector<maths::triangle3d> mt_triangles;
+		mt_importer.import(back_inserter(mt_triangles));
+
+		ensure_equals(mt_importer.name(), importer.name());
+		ensure_equals(mt_importer.num_facets_read(), 12);
+		ensure_equals(mt_triangles.size(), stl_triangles.size());
+
+		for (size_t i = 0 ; i < stl_triangles.size() ; i++)
+		{
+			for (size_t j = 0 ; j < 3 ; j++)
+				ensure(mt_triangles[i][j] == stl_triangles[i][j]);
+		}
+	}
+
+	// Too short to have a header, however it's read
+	for (unsigned num_threads : { 1, 4 })
+	{
+		stl_util::stl_importer bad_importer(make_shared<std::istringstream>(string(60, '\x01')));
+		bad_importer.set_num_threads(num_threads);
+
+		try
+		{
+			std::vector<maths::triangle3d> bad_triangles;
+			bad_importer.import(back_inserter(bad_triangles));
+			fail("Imported a binary STL without a header");
+		}
+		catch (std::runtime_error& e)
+		{
+			ensure_equals(string(e.what()), "Error reading STL header");
+		}
+	}
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<10>()
+{
+	set_test_name("Estimated facet count");
+
+	stl_util::stl_importer importer(test_data_path() + "/DNA_L.stl", stl_util::facet_count_mode::estimate);
+
+	ensure(!importer.facet_count_is_exact());
+	ensure(importer.num_facets_expected() > 0);
+
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	ensure(importer.facet_count_is_exact());
+	ensure_equals(importer.num_facets_expected(), stl_triangles.size());
+	ensure_equals(importer.num_facets_read(), stl_triangles.size());
+
+	// The header count of a binary STL is always used
+	stl_util::stl_importer binary_importer(test_data_path() + "/unit_cube.stl", stl_util::facet_count_mode::estimate);
+	ensure(binary_importer.facet_count_is_exact());
+	ensure_equals(binary_importer.num_facets_expected(), 12);
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<11>()
+{
+	set_test_name("Triangle soup import");
+
+	for (const std::string stl_file : { "/unit_cube.stl", "/sphere.stl" })
+	{
+		const std::string file_path = test_data_path() + stl_file;
+
+		stl_util::stl_importer importer(file_path);
+
+		std::vector<maths::triangle3d> stl_triangles;
+		importer.import(back_inserter(stl_triangles));
+
+		triangle_soup soup;
+		importer.import_soup(soup);
+
+		ensure_equals(importer.num_facets_read(), stl_triangles.size());
+		ensure_equals(soup.size(), stl_triangles.size());
+		ensure_equals(soup.name(), importer.name());
+		ensure(!soup.has_normals());
+		ensure(!soup.has_attributes());
+
+		for (size_t i = 0 ; i < soup.size() ; i++)
+		{
+			for (size_t j = 0 ; j < 3 ; j++)
+			{
+				ensure_equals(soup.x()[3 * i + j], (float) stl_triangles[i][j].x());
+				ensure_equals(soup.y()[3 * i + j], (float) stl_triangles[i][j].y());
+				ensure_equals(soup.z()[3 * i + j], (float) stl_triangles[i][j].z());
+			}
+		}
+
+		// With normals and attributes, from a stream and on multiple threads
+		auto stl_ifstream = make_shared<ifstream>(file_path, std::ifstream::binary);
+		stl_util::stl_importer stream_importer(stl_ifstream);
+
+		triangle_soup stream_soup(true, true);
+		stream_importer.import_soup(stream_soup);
+
+		triangle_soup mt_soup(true, true);
+		importer.set_num_threads(4);
+		importer.import_soup(mt_soup);
+
+		for (const triangle_soup* other_soup : { &stream_soup, &mt_soup })
+		{
+			ensure_equals(other_soup->size(), soup.size());
+			ensure(other_soup->has_normals());
+			ensure(other_soup->has_attributes());
+
+			for (size_t i = 0 ; i < soup.size() ; i++)
+			{
+				for (size_t j = 0 ; j < 3 ; j++)
+					ensure(other_soup->get_point(i, j) == soup.get_point(i, j));
+
+				ensure(other_soup->get_normal(i) == stream_soup.get_normal(i));	// from the file
+				ensure_equals(other_soup->get_attribute(i), 0);
+			}
+		}
+	}
+
+	// Too short to have a header
+	try
+	{
+		triangle_soup bad_soup;
+		stl_util::stl_importer(make_shared<std::istringstream>(string(60, '\x01'))).import_soup(bad_soup);
+		fail("Imported a binary STL without a header");
+	}
+	catch (std::runtime_error&)
+	{
+	}
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<12>()
+{
+	set_test_name("STL export");
+
+	stl_util::stl_importer importer(test_data_path() + "/DNA_L.stl");
+
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	compact_mesh mesh(stl_triangles);
+	mesh.name() = "DNA test";
+
+	triangle_soup soup(false, true);
+	for (size_t i = 0 ; i < stl_triangles.size() ; i++)
+		soup.push_back(stl_triangles[i], stl_triangles[i].normal(), (std::uint16_t) i);
+
+	soup.name() = "soup";
+
+	for (auto format : { stl_util::stl_format::binary, stl_util::stl_format::ascii })
+	{
+		auto mesh_stream = make_shared<std::stringstream>();
+		stl_util::stl_exporter(*mesh_stream, format).write(mesh);
+
+		stl_util::stl_importer mesh_importer(mesh_stream);
+
+		std::vector<maths::triangle3d> mesh_triangles;
+		mesh_importer.import(back_inserter(mesh_triangles));
+
+		ensure_equals(mesh_importer.name(), "DNA test");
+		ensure_equals(mesh_triangles.size(), mesh.num_facets());
+
+		// Coordinates come back as the same floats
+		for (size_t f = 0 ; f < mesh.num_facets() ; f++)
+		{
+			const maths::triangle3d t = mesh.get_triangle((compact_mesh::index_t) f);
+			for (size_t c = 0 ; c < 3 ; c++)
+			{
+				for (size_t i = 0 ; i < 3 ; i++)
+					ensure_equals((float) mesh_triangles[f][c][i], (float) t[c][i]);
+			}
+		}
+
+		auto soup_stream = make_shared<std::stringstream>();
+		stl_util::stl_exporter(*soup_stream, format).write(soup);
+
+		stl_util::stl_importer soup_importer(soup_stream);
+
+		triangle_soup imported_soup(false, true);
+		soup_importer.import_soup(imported_soup);
+
+		ensure_equals(imported_soup.name(), "soup");
+		ensure_equals(imported_soup.size(), soup.size());
+
+		for (size_t f = 0 ; f < soup.size() ; f++)
+		{
+			for (size_t c = 0 ; c < 3 ; c++)
+				ensure(imported_soup.get_point(f, c) == soup.get_point(f, c));
+
+			// ASCII STLs don't have attributes
+			ensure_equals(imported_soup.get_attribute(f), format == stl_util::stl_format::binary ? soup.get_attribute(f) : 0);
+		}
+	}
+
+	// operator<< writes ASCII
+	triangle_mesh t_mesh(stl_triangles);
+	t_mesh.name() = "operator<<";
+
+	auto t_mesh_stream = make_shared<std::stringstream>();
+	*t_mesh_stream << t_mesh;
+
+	ensure_equals(t_mesh_stream->str().compare(0, 17, "solid operator<<\n"), 0);
+
+	stl_util::stl_importer t_mesh_importer(t_mesh_stream);
+	std::vector<maths::triangle3d> t_mesh_triangles;
+	t_mesh_importer.import(back_inserter(t_mesh_triangles));
+
+	ensure_equals(t_mesh_importer.name(), "operator<<");
+	ensure_equals(t_mesh_triangles.size(), stl_triangles.size());
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<13>()
+{
+	set_test_name("Async import and cancellation");
+
+	stl_util::stl_importer importer(test_data_path() + "/DNA_L.stl");
+
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	for (unsigned num_threads : { 1, 4 })
+	{
+		importer.set_num_threads(num_threads);
+
+		// The async import gets the same facets, and ends with all of the input read
+		const std::vector<maths::triangle3d> async_triangles = importer.import_async().get();
+
+		ensure(!importer.canceled());
+		ensure_equals(async_triangles.size(), stl_triangles.size());
+		for (size_t f = 0 ; f < stl_triangles.size() ; f++)
+			for (size_t c = 0 ; c < 3 ; c++)
+				ensure(async_triangles[f][c] == stl_triangles[f][c]);
+
+		const stl_util::import_progress progress = importer.progress();
+		ensure_equals(progress.facets_read, stl_triangles.size());
+		ensure_equals(progress.facets_expected, stl_triangles.size());
+		ensure(progress.bytes_total > 0);
+		ensure_equals(progress.bytes_read, progress.bytes_total);
+		ensure_equals(progress.fraction(), 1.0);
+
+		// Canceling before the import starts stops it before anything is output
+		std::vector<maths::triangle3d> canceled_triangles;
+		importer.cancel();
+		importer.import_async(back_inserter(canceled_triangles)).get();
+
+		ensure(importer.canceled());
+		ensure(canceled_triangles.empty());
+
+		// ... and the importer can be used again afterwards
+		ensure_equals(importer.import_async().get().size(), stl_triangles.size());
+		ensure(!importer.canceled());
+	}
+
+	// Canceling partway through stops after the current batch
+	size_t num_batches = 0;
+	size_t num_facets = 0;
+	importer.import_batches([&](const maths::triangle3d*, size_t num_triangles)
+	{
+		num_batches++;
+		num_facets += num_triangles;
+		importer.cancel();
+	});
+
+	ensure(importer.canceled());
+	ensure_equals(num_batches, 1u);
+	ensure(num_facets < stl_triangles.size());
+	ensure_equals(importer.progress().facets_read, num_facets);
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<14>()
+{
+	set_test_name("Synthetic STL generator");
+
+	// Closed shapes are manifold, with the right volume
+	stl_util::stl_generator sphere(stl_util::generated_shape::sphere, 20000);
+	ensure(sphere.num_facets() > 19000 && sphere.num_facets() < 21000);
+
+	compact_mesh sphere_mesh(sphere.get_triangles());
+	ensure(sphere_mesh.is_manifold());
+	ensure_equals(sphere_mesh.num_facets(), sphere.num_facets());
+	ensure(fabs(sphere_mesh.volume() - 4.0 / 3.0 * M_PI) < 0.01);
+
+	stl_util::stl_generator torus(stl_util::generated_shape::torus, 20000);
+	compact_mesh torus_mesh(torus.get_triangles());
+	ensure(torus_mesh.is_manifold());
+	ensure(fabs(torus_mesh.volume() - 2.0 * M_PI * M_PI * 0.25 * 0.25) < 0.01);
+
+	// Grids are open, and the fins make three facets meet on each cell diagonal
+	stl_util::stl_generator grid(stl_util::generated_shape::grid, 5000);
+	compact_mesh grid_mesh(grid.get_triangles());
+	ensure(!grid_mesh.is_manifold());
+	ensure(fabs(grid_mesh.area() - 1.0) < 1e-9);
+
+	stl_util::stl_generator non_manifold(stl_util::generated_shape::non_manifold, 3000);
+	ensure_equals(non_manifold.num_facets() % 3, 0u);
+	ensure(non_manifold.get_triangle(0)[0] == non_manifold.get_triangle(2)[0]);
+	ensure(non_manifold.get_triangle(0)[2] == non_manifold.get_triangle(2)[1]);
+
+	// Jittered soups share no vertices, but weld back into the sphere
+	stl_util::stl_generator soup(stl_util::generated_shape::jittered_soup, 20000, 42);
+	ensure(soup.jitter() > 0.0);
+
+	compact_mesh soup_mesh(soup.get_triangles());
+	ensure_equals(soup_mesh.num_vertices(), 3 * soup.num_facets());
+
+	compact_mesh welded_mesh;
+	welded_mesh.set_weld_tolerance(10.0 * soup.jitter());
+	welded_mesh.build(soup.get_triangles());
+	ensure_equals(welded_mesh.num_vertices(), sphere_mesh.num_vertices());
+
+	// The same seed gives the same soup
+	stl_util::stl_generator same_soup(stl_util::generated_shape::jittered_soup, 20000, 42);
+	for (size_t f = 0 ; f < soup.num_facets() ; f += 97)
+		for (size_t c = 0 ; c < 3 ; c++)
+			ensure(same_soup.get_triangle(f)[c] == soup.get_triangle(f)[c]);
+
+	// Written one facet at a time, and read back
+	for (auto format : { stl_util::stl_format::binary, stl_util::stl_format::ascii })
+	{
+		auto torus_stream = make_shared<std::stringstream>();
+		stl_util::stl_exporter(*torus_stream, format).write(torus);
+
+		stl_util::stl_importer torus_importer(torus_stream);
+
+		std::vector<maths::triangle3d> torus_triangles;
+		torus_importer.import(back_inserter(torus_triangles));
+
+		ensure_equals(torus_importer.name(), "generated_torus");
+		ensure_equals(torus_triangles.size(), torus.num_facets());
+	}
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<15>()
+{
+	set_test_name("Import instrumentation");
+
+	// A blank line and a facet with a bad vertex, which get skipped
+	auto stl_stream = make_shared<std::stringstream>(
+		"solid stats\n"
+		"facet normal 0 0 1\n outer loop\n  vertex 0 0 0\n  vertex 1 0 0\n  vertex 0 1 0\n endloop\nendfacet\n"
+		"\n"
+		"facet normal 0 0 1\n outer loop\n  vertex 0 0 0\n  vertex 1 0 x\n"
+		"facet normal 0 0 1\n outer loop\n  vertex 0 0 1\n  vertex 1 0 1\n  vertex 0 1 1\n endloop\nendfacet\n"
+		"endsolid\n");
+
+	// Estimating the facet count, so that the STL is only read once
+	stl_util::stl_importer importer(stl_stream, stl_util::facet_count_mode::estimate);
+
+	std::vector<maths::triangle3d> triangles;
+	importer.import(back_inserter(triangles));
+	ensure_equals(triangles.size(), 2u);
+
+	triangle_mesh mesh;
+	mesh.build(triangles);
+
+	const stl_util::import_stats& stats = importer.stats();
+	const stl_util::mesh_build_stats& build_stats = mesh.build_stats();
+
+	if (!stl_util::instrumentation_enabled)
+	{
+		ensure_equals(stats.facets_parsed, 0u);
+		ensure_equals(stats.total_seconds, 0.0);
+		ensure_equals(build_stats.facets, 0u);
+		return;
+	}
+
+	ensure_equals(stats.facets_parsed, 2u);
+	ensure_equals(stats.bytes_read, stl_stream->str().size());
+	ensure_equals(stats.lines_skipped, 5u);	// the blank line and the 4 lines of the bad facet
+	ensure(stats.buffer_allocations > 0);
+	ensure(stats.total_seconds >= stats.parse_seconds + stats.output_seconds);
+
+	ensure_equals(build_stats.facets, 2u);
+	ensure_equals(build_stats.vertices, 6u);
+	ensure_equals(build_stats.allocations, 2u * 4 + 6);
+
+	// The counts add up until they're reset
+	importer.import(back_inserter(triangles));
+	ensure_equals(importer.stats().facets_parsed, 4u);
+
+	importer.reset_stats();
+	ensure_equals(importer.stats().facets_parsed, 0u);
+}
+
+template <> template <>
+void stl_importer_test_t::object::test<16>()
+{
+	set_test_name("Streaming import from a non-seekable stream");
+
+	stl_util::stl_importer importer(test_data_path() + "/DNA_L.stl");
+
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	for (auto format : { stl_util::stl_format::binary, stl_util::stl_format::ascii })
+	{
+		std::ostringstream stl_stream;
+		stl_util::stl_exporter(stl_stream, format).write(stl_triangles, "streamed");
+
+		for (unsigned num_threads : { 1, 4 })
+		{
+			stl_util::stl_importer stream_importer(make_shared<forward_only_istream>(stl_stream.str()), stl_util::facet_count_mode::streaming);
+			stream_importer.set_num_threads(num_threads);
+
+			ensure_equals(stream_importer.is_ascii(), format == stl_util::stl_format::ascii);
+
+			// Binary STLs have the count in the header
+			ensure_equals(stream_importer.facet_count_is_exact(), format == stl_util::stl_format::binary);
+			if (format == stl_util::stl_format::binary)
+				ensure_equals(stream_importer.num_facets_expected(), stl_triangles.size());
+
+			std::vector<maths::triangle3d> stream_triangles;
+			stream_importer.import(back_inserter(stream_triangles));
+
+			ensure_equals(stream_importer.name(), "streamed");
+			ensure_equals(stream_triangles.size(), stl_triangles.size());
+			ensure_equals(stream_importer.num_facets_expected(), stl_triangles.size());
+
+			// The coordinates went out as floats
+			for (size_t f = 0 ; f < stl_triangles.size() ; f++)
+				for (size_t c = 0 ; c < 3 ; c++)
+					for (size_t i = 0 ; i < 3 ; i++)
+						ensure_equals((float) stream_triangles[f][c][i], (float) stl_triangles[f][c][i]);
+
+			// There's no going back for another go
+			try
+			{
+				stream_importer.import(back_inserter(stream_triangles));
+				fail("Imported a stream twice");
+			}
+			catch (std::runtime_error&)
+			{
+			}
+		}
+	}
+
+	// Shorter than the peek, and not an STL at all
+	stl_util::stl_importer tetrahedron_importer(make_shared<forward_only_istream>(get_tetrahedron_stl_str()), stl_util::facet_count_mode::streaming);
+	std::vector<maths::triangle3d> tetrahedron_triangles;
+	tetrahedron_importer.import(back_inserter(tetrahedron_triangles));
+	ensure_equals(tetrahedron_triangles.size(), 4u);
+
+	stl_util::stl_importer junk_importer(make_shared<forward_only_istream>("junk"), stl_util::facet_count_mode::streaming);
+	try
+	{
+		std::vector<maths::triangle3d> junk_triangles;
+		junk_importer.import(back_inserter(junk_triangles));
+		fail("Imported junk");
+	}
+	catch (std::runtime_error& e)
+	{
+		ensure_equals(string(e.what()), "Error reading STL header");
+	}
+}
+
+template<>
+template<>
+void stl_importer_test_t::object::test<17>()
+{
+	set_test_name("Read ahead import");
+
+	// Small blocks, so that the ring wraps around many times
+	string data(100000, '\0');
+	for (size_t i = 0 ; i < data.size() ; i++)
+		data[i] = (char) ('a' + (i * 7) % 26);
+
+	std::stringbuf source(data, std::ios::in);
+	stl_util::read_ahead_streambuf read_ahead(&source, 4096, 2);
+	std::istream read_ahead_stream(&read_ahead);
+
+	ensure_equals(string(std::istreambuf_iterator<char>(read_ahead_stream), std::istreambuf_iterator<char>()), data);
+	ensure(!read_ahead.error());
+
+	read_ahead_stream.clear();
+	read_ahead_stream.seekg(0, std::ios::end);
+	ensure_equals((size_t) read_ahead_stream.tellg(), data.size());
+
+	for (size_t pos : { 50000, 50010, 10, 99990 })
+	{
+		char buf[10];
+		read_ahead_stream.seekg((streamoff) pos);
+		read_ahead_stream.read(buf, sizeof(buf));
+		ensure_equals(string(buf, sizeof(buf)), data.substr(pos, sizeof(buf)));
+		ensure_equals((size_t) read_ahead_stream.tellg(), pos + sizeof(buf));
+	}
+
+	// A source that hands over a little at a time, like a pipe, isn't at the end until it says so
+	class trickle_stringbuf : public std::stringbuf
+	{
+	public:
+		trickle_stringbuf(const string& s) : std::stringbuf(s, std::ios::in) { }
+
+	protected:
+		std::streamsize xsgetn(char* s, std::streamsize n) override { return std::stringbuf::xsgetn(s, std::min<std::streamsize>(n, 1000)); }
+	};
+
+	{
+		trickle_stringbuf trickle_source(data);
+		stl_util::read_ahead_streambuf trickle_read_ahead(&trickle_source, 4096, 2);
+		std::istream trickle_stream(&trickle_read_ahead);
+
+		ensure_equals(string(std::istreambuf_iterator<char>(trickle_stream), std::istreambuf_iterator<char>()), data);
+	}
+
+	// Importing through the I/O thread gets the same facets as reading directly
+	const string filename = test_data_path() + "/DNA_L.stl";
+
+	stl_util::stl_importer importer(filename);
+	std::vector<maths::triangle3d> stl_triangles;
+	importer.import(back_inserter(stl_triangles));
+
+	std::ostringstream ascii_stream;
+	stl_util::stl_exporter(ascii_stream, stl_util::stl_format::ascii).write(stl_triangles, "read_ahead");
+
+	// A mapped ASCII file only starts reading ahead once it's parsed on one thread
+	const string ascii_filename = (std::filesystem::temp_directory_path() / "stl_importer_read_ahead.stl").string();
+	std::ofstream(ascii_filename, std::ios::binary) << ascii_stream.str();
+
+	std::vector<std::unique_ptr<stl_util::stl_importer>> read_ahead_importers;
+	read_ahead_importers.push_back(std::make_unique<stl_util::stl_importer>(filename, stl_util::facet_count_mode::exact, stl_util::io_mode::read_ahead));
+	read_ahead_importers.push_back(std::make_unique<stl_util::stl_importer>(ascii_filename, stl_util::facet_count_mode::exact, stl_util::io_mode::read_ahead));
+	read_ahead_importers.push_back(std::make_unique<stl_util::stl_importer>(make_shared<std::istringstream>(ascii_stream.str()),
+		stl_util::facet_count_mode::exact, stl_util::io_mode::read_ahead));
+	read_ahead_importers.push_back(std::make_unique<stl_util::stl_importer>(make_shared<forward_only_istream>(ascii_stream.str()),
+		stl_util::facet_count_mode::streaming, stl_util::io_mode::read_ahead));
+
+	for (auto& read_ahead_importer : read_ahead_importers)
+	{
+		const bool streaming = read_ahead_importer.get() == read_ahead_importers.back().get();
+		ensure_equals(read_ahead_importer->num_facets_expected(), streaming ? 0u : stl_triangles.size());
+
+		// More than once, to make sure that rewinding works
+		for (unsigned num_threads : { 1, 4, 1 })
+		{
+			read_ahead_importer->set_num_threads(num_threads);
+
+			std::vector<maths::triangle3d> read_ahead_triangles;
+			read_ahead_importer->import(back_inserter(read_ahead_triangles));
+
+			ensure_equals(read_ahead_triangles.size(), stl_triangles.size());
+			for (size_t f = 0 ; f < stl_triangles.size() ; f++)
+				for (size_t c = 0 ; c < 3 ; c++)
+					for (size_t i = 0 ; i < 3 ; i++)
+						ensure_equals((float) read_ahead_triangles[f][c][i], (float) stl_triangles[f][c][i]);
+
+			if (streaming)
+				break;
+		}
+	}
+
+	std::filesystem::remove(ascii_filename);
+
+	// A source that fails part way through, which the parser would otherwise take for the end
+	class failing_stringbuf : public std::stringbuf
+	{
+	public:
+		failing_stringbuf(const string& s) : std::stringbuf(s, std::ios::in) { }
+
+	protected:
+		std::streamsize xsgetn(char* s, std::streamsize n) override
+		{
+			if (gptr() - eback() >= (std::ptrdiff_t) str().size() / 2)
+				throw std::ios_base::failure("Disk on fire");
+
+			return std::stringbuf::xsgetn(s, std::min<std::streamsize>(n, 1000));
+		}
+	};
+
+	auto ensure_read_error = [&](const std::function<void(stl_util::stl_importer&)>& import)
+	{
+		failing_stringbuf failing_source(ascii_stream.str());
+		auto failing_stream = make_shared<std::istream>(&failing_source);
+		stl_util::stl_importer failing_importer(failing_stream, stl_util::facet_count_mode::estimate, stl_util::io_mode::read_ahead);
+
+		try
+		{
+			import(failing_importer);
+			fail("Imported an STL that couldn't be read");
+		}
+		catch (std::runtime_error& e)
+		{
+			ensure_equals(string(e.what()), "Error reading STL");
+		}
+	};
+
+	for (unsigned num_threads : { 1, 4 })
+	{
+		ensure_read_error([&](stl_util::stl_importer& importer)
+		{
+			std::vector<maths::triangle3d> triangles;
+			importer.set_num_threads(num_threads);
+			importer.import(back_inserter(triangles));
+		});
+	}
+
+	ensure_read_error([](stl_util::stl_importer& importer) { importer.import_batches([](const maths::triangle3d*, size_t) { }); });
+	ensure_read_error([](stl_util::stl_importer& importer) { triangle_soup soup; importer.import_soup(soup); });
+}
+
+template<>
+template<>
+void stl_importer_test_t::object::test<18>()
+{
+	set_test_name("Format detection");
+
+	std::vector<maths::triangle3d> triangles = stl_util::stl_generator(stl_util::generated_shape::sphere, 100).get_triangles();
+
+	// A binary STL whose header reads like the start of an ASCII STL
+	std::ostringstream binary_stream;
+	stl_util::stl_exporter(binary_stream, stl_util::stl_format::binary).write(triangles, "solid x\nfacet normal 0 0 1\n");
+	const string binary_str = binary_stream.str();
+	ensure_equals(binary_str.substr(0, 7), "solid x");
+
+	// A binary STL with no newline anywhere near the start, and a truncated one
+	std::ostringstream no_newline_stream;
+	stl_util::stl_exporter(no_newline_stream, stl_util::stl_format::binary).write(triangles, string(80, 'x'));
+	string no_newline_str = no_newline_stream.str();
+	std::replace(no_newline_str.begin(), no_newline_str.end(), '\n', ' ');
+
+	struct detection_case
+	{
+		string	stl;
+		bool	ascii;
+		size_t	num_facets;
+	};
+
+	const detection_case cases[] =
+	{
+		{ binary_str, false, triangles.size() },
+		{ no_newline_str, false, triangles.size() },
+		{ binary_str.substr(0, binary_str.size() - 10), false, triangles.size() - 1 },
+		{ get_tetrahedron_stl_str(), true, 4 },
+		{ "sol", false, 0 },
+		{ "", false, 0 },
+	};
+
+	for (const detection_case& c : cases)
+	{
+		stl_util::stl_importer importer(make_shared<std::istringstream>(c.stl));
+		ensure_equals(importer.is_ascii(), c.ascii);
+
+		// Too short for either format's header
+		if (c.num_facets == 0)
+		{
+			try
+			{
+				std::vector<maths::triangle3d> imported;
+				importer.import(back_inserter(imported));
+				fail("Imported an STL without a header");
+			}
+			catch (std::runtime_error&)
+			{
+			}
+
+			continue;
+		}
+
+		std::vector<maths::triangle3d> imported;
+		importer.import(back_inserter(imported));
+		ensure_equals(imported.size(), c.num_facets);
+	}
+}
+
+template<>
+template<>
+void stl_importer_test_t::object::test<19>()
+{
+	set_test_name("ASCII export of extreme coordinates");
+
+	// Coordinates that take the most characters (15 each), in every slot including the normal,
+	// so each facet is as long as a facet can get
+	const double coords[] = { -1.00211145e-36, -1.00211225e-36, -1.00211315e-36, -1.00211405e-36 };
+
+	triangle_soup soup(true);
+	for (size_t f = 0 ; f < 1000 ; f++)
+	{
+		auto coord = [&](size_t i) { return coords[(f + i) % 4]; };
+
+		soup.push_back(maths::triangle3d(maths::vector3d(coord(0), coord(1), coord(2)),
+										 maths::vector3d(coord(1), coord(2), coord(3)),
+										 maths::vector3d(coord(2), coord(3), coord(0))),
+					   maths::vector3d(coord(3), coord(0), coord(1)));
+	}
+
+	auto stl_stream = make_shared<std::stringstream>();
+	stl_util::stl_exporter(*stl_stream, stl_util::stl_format::ascii).write(soup);
+
+	ensure(stl_stream->str().find("vertex -1.00211145e-36 -1.00211225e-36 -1.00211315e-36\n") != string::npos);
+
+	stl_util::stl_importer importer(stl_stream);
+
+	triangle_soup imported(true);
+	importer.import_soup(imported);
+
+	ensure_equals(imported.size(), soup.size());
+	for (size_t f = 0 ; f < soup.size() ; f++)
+	{
+		ensure(imported.get_normal(f) == soup.get_normal(f));
+		for (size_t v = 0 ; v < 3 ; v++)
+			ensure(imported.get_point(f, v) == soup.get_point(f, v));
+	}
+}
+
+template<>
+template<>
+void stl_importer_test_t::object::test<20>()
+{
+	set_test_name("Bad binary facet count");
+
+	stl_util::stl_importer sphere_importer(test_data_path() + "/sphere.stl");
+	std::vector<maths::triangle3d> triangles;
+	sphere_importer.import(back_inserter(triangles));
+
+	const string stl_str = get_bad_facet_count_stl_str(triangles);
+
+	const string filename = (std::filesystem::temp_directory_path() / "stl_importer_bad_count.stl").string();
+	std::ofstream(filename, std::ios::binary) << stl_str;
+
+	// The header's count is reported as is, but only what's actually there gets reserved
+	for (bool from_file : { true, false })
+	{
+		auto importer = from_file ? make_unique<stl_util::stl_importer>(filename) :
+									make_unique<stl_util::stl_importer>(make_shared<std::istringstream>(stl_str));
+
+		ensure_equals(importer->num_facets_expected(), 0xffffffffu);
+		ensure_equals(importer->num_facets_to_reserve(), triangles.size());
+
+		compact_mesh mesh;
+		stl_util::import_compact_mesh(*importer, mesh);
+
+		ensure_equals(mesh.num_facets(), triangles.size());
+	}
+
+	{
+		stl_util::stl_importer importer(make_shared<std::istringstream>(stl_str));
+
+		triangle_soup soup;
+		importer.import_soup(soup);
+
+		ensure_equals(soup.size(), triangles.size());
+	}
+
+	// import_async() reserves up front too, away from the calling thread, so an error
+	// wouldn't show up until get().  Say which import threw what if one does.
+	for (unsigned num_threads : { 1, 4 })
+	{
+		const string which = "import_async() with " + to_string(num_threads) + " thread(s) ";
+
+		stl_util::stl_importer importer(make_shared<std::istringstream>(stl_str));
+		importer.set_num_threads(num_threads);
+
+		std::vector<maths::triangle3d> async_triangles;
+		std::vector<maths::triangle3d> iterator_triangles;
+		try
+		{
+			async_triangles = importer.import_async().get();
+			importer.import_async(back_inserter(iterator_triangles)).get();
+		}
+		catch (std::exception& e)
+		{
+			fail(which + "threw: " + e.what());
+		}
+
+		ensure_equals(which + "facets", async_triangles.size(), triangles.size());
+		ensure_equals(which + "to an iterator facets", iterator_triangles.size(), triangles.size());
+
+		// Whereas a real error comes out of get(), as is
+		stl_util::stl_importer headerless_importer(make_shared<std::istringstream>(stl_str.substr(0, 40)));
+		headerless_importer.set_num_threads(num_threads);
+
+		try
+		{
+			headerless_importer.import_async().get();
+			fail(which + "imported an STL without a header");
+		}
+		catch (std::runtime_error& e)
+		{
+			ensure_equals(which + "error", string(e.what()), "Error reading STL header");
+		}
+	}
+
+	std::filesystem::remove(filename);
+}
+
 };
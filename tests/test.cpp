@@ -23,9 +23,11 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <limits>
 #include <iterator>
 #include <stdexcept>
 
@@ -442,6 +444,12 @@ namespace tut
 		ensure(mesh1.get_halfedges().size() == mesh2.get_halfedges().size());
 		ensure(mesh1.get_facets().size() == mesh2.get_facets().size());
 		ensure(mesh1.get_vertices().size() == mesh2.get_vertices().size());
+
+		// A stream that can't be written to fails, rather than throwing
+		std::stringbuf read_only_buf(std::ios::in);
+		std::ostream read_only_os(&read_only_buf);
+		read_only_os << mesh1;
+		ensure(read_only_os.fail());
 	}
 
 	template<> template<>
@@ -480,4 +488,178 @@ namespace tut
 		ensure("no facets read", importer.num_facets_read() == mesh.get_facets().size());
 		ensure("mesh not solid", mesh.is_manifold());
 	}
+
+	template<> template<>
+	void stl_test_group_t::object::test<14>()
+	{
+		set_test_name("Triangle mesh - parallel build");
+
+		for (const string stl_file : { "/sphere.stl", "/bottle.stl", "/DNA_L.stl", "/unit_sphere-ascii.stl" })
+		{
+			stl_util::stl_importer importer(test_data_path() + stl_file);
+
+			std::vector<maths::triangle3d> triangles;
+			importer.import(std::back_inserter(triangles));
+
+			triangle_mesh mesh;
+			mesh.build(triangles);
+
+			triangle_mesh mt_mesh;
+			mt_mesh.build(triangles, 4);
+
+			ensure(mesh == mt_mesh);
+			ensure(mesh.get_vertices().size() == mt_mesh.get_vertices().size());
+			ensure(mesh.get_edges().size() == mt_mesh.get_edges().size());
+			ensure(mesh.get_lamina_halfedges().size() == mt_mesh.get_lamina_halfedges().size());
+
+			// The vertices and halfedges should be in the same order, and connected the same way
+			for (size_t i = 0 ; i < mesh.get_vertices().size() ; i++)
+				ensure(mesh.get_vertices()[i]->get_point() == mt_mesh.get_vertices()[i]->get_point());
+
+			std::map<mesh_halfedge_ptr, size_t> halfedge_index, mt_halfedge_index;
+			for (size_t i = 0 ; i < mesh.get_halfedges().size() ; i++)
+			{
+				halfedge_index[mesh.get_halfedges()[i]] = i;
+				mt_halfedge_index[mt_mesh.get_halfedges()[i]] = i;
+			}
+
+			for (size_t i = 0 ; i < mesh.get_halfedges().size() ; i++)
+			{
+				mesh_halfedge_ptr sym = mesh.get_halfedges()[i]->get_sym_halfedge();
+				mesh_halfedge_ptr mt_sym = mt_mesh.get_halfedges()[i]->get_sym_halfedge();
+
+				ensure(!sym == !mt_sym);
+				if (sym)
+					ensure(halfedge_index[sym] == mt_halfedge_index[mt_sym]);
+			}
+		}
+	}
+
+	template <> template <>
+	void stl_test_group_t::object::test<15>()
+	{
+		set_test_name("Triangle mesh - interleaved VBO buffer");
+
+		stl_util::stl_importer importer(test_data_path() + "/bottle.stl");
+
+		std::vector<maths::triangle3d> triangles;
+		importer.import(back_inserter(triangles));
+
+		triangle_mesh mesh(triangles);
+		triangle_mesh::vbo_data_t vbo_data = mesh.get_vbo_data();
+
+		vbo_buffer<double> d_buffer = mesh.get_vbo_buffer<double>();
+		vbo_buffer<float> f_buffer = mesh.get_vbo_buffer();
+
+		ensure_equals(vbo_buffer<float>::STRIDE, 6 * sizeof(float));
+		ensure_equals(d_buffer.num_vertices(), mesh.get_vertices().size());
+		ensure_equals(f_buffer.num_vertices(), mesh.get_vertices().size());
+		ensure_equals(d_buffer.num_facets(), mesh.get_facets().size());
+		ensure(d_buffer.indices == f_buffer.indices);
+		ensure(std::equal(d_buffer.indices.begin(), d_buffer.indices.end(), vbo_data.indices.begin()));
+
+		for (size_t v = 0 ; v < d_buffer.num_vertices() ; v++)
+		{
+			const mesh_vertex_ptr& mesh_vert = mesh.get_vertices()[v];
+
+			ensure(d_buffer.get_point(v) == mesh_vert->get_point());
+			ensure(d_buffer.get_normal(v) == mesh_vert->get_normal());
+			ensure(d_buffer.get_point(v) == maths::vector3d(vbo_data.verts[v][0], vbo_data.verts[v][1], vbo_data.verts[v][2]));
+
+			ensure(f_buffer.get_point(v).is_close(mesh_vert->get_point(), 1.0e-5));
+		}
+
+		// The indices make up the same triangles
+		for (size_t f = 0 ; f < d_buffer.num_facets() ; f++)
+		{
+			const maths::triangle3d t = mesh.get_facets()[f]->get_triangle();
+			for (size_t i = 0 ; i < 3 ; i++)
+				ensure(d_buffer.get_point(d_buffer.indices[3 * f + i]) == t[i]);
+		}
+	}
+
+	template <> template <>
+	void stl_test_group_t::object::test<16>()
+	{
+		set_test_name("Triangle mesh - cached properties");
+
+		for (const string stl_file : { "/sphere.stl", "/DNA_L.stl" })
+		{
+			stl_util::stl_importer importer(test_data_path() + stl_file);
+
+			std::vector<maths::triangle3d> triangles;
+			importer.import(back_inserter(triangles));
+
+			double area = 0.0, signed_volume = 0.0;
+			for (const auto& t : triangles)
+			{
+				area += t.area();
+				signed_volume += t.signed_volume();
+			}
+
+			// Properties are kept up to date as triangles are added
+			triangle_mesh mesh;
+			for (const auto& t : triangles)
+				mesh.add_triangle(t);
+
+			ensure_distance(mesh.area(), area, 1.0e-10 * area);
+			ensure_distance(mesh.volume(), std::abs(signed_volume), 1.0e-10 * area);
+			ensure_equals(mesh.is_manifold(), mesh.get_lamina_halfedges().empty());
+
+			triangle_mesh mt_mesh;
+			mt_mesh.build(triangles, 4);
+
+			ensure_equals(mt_mesh.is_manifold(), mesh.is_manifold());
+			ensure_distance(mt_mesh.area(), mesh.area(), 1.0e-10 * area);
+			ensure(mt_mesh.bbox().min() == mesh.bbox().min());
+			ensure(mt_mesh.bbox().max() == mesh.bbox().max());
+
+			// Moving vertices invalidates the cache
+			const maths::bbox3d bbox = mesh.bbox();
+			mesh.center();
+
+			const maths::vector3d centered_max = mesh.bbox().max();
+			ensure(centered_max != bbox.max());
+			ensure_distance(mesh.area(), area, 1.0e-8 * area);
+
+			const mesh_vertex_ptr& v = mesh.get_vertices().front();
+			v->set_point(centered_max + maths::vector3d(1.0, 1.0, 1.0));
+			ensure(mesh.bbox().max() == centered_max + maths::vector3d(1.0, 1.0, 1.0));
+			ensure(mesh.area() != area);
+		}
+
+		triangle_mesh empty_mesh;
+		ensure_equals(empty_mesh.area(), 0.0);
+		ensure(empty_mesh.bbox().is_empty());
+		ensure(empty_mesh.is_manifold());
+	}
+
+	template <> template <>
+	void stl_test_group_t::object::test<17>()
+	{
+		set_test_name("Triangle mesh - parallel build with NaNs");
+
+		stl_util::stl_importer importer(test_data_path() + "/sphere.stl");
+
+		std::vector<maths::triangle3d> triangles;
+		importer.import(back_inserter(triangles));
+
+		// A corrupt STL can have NaN coordinates, which the sort mustn't choke on.
+		// Corners with the same NaN end up at the same vertex.
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		const maths::vector3d nan_point(nan, 0.0, nan);
+		const maths::triangle3d t0 = triangles[0];
+		triangles.push_back(maths::triangle3d(nan_point, t0[0], t0[1]));
+		triangles.push_back(maths::triangle3d(t0[1], nan_point, t0[2]));
+
+		// -0.0 and 0.0 are the same point
+		triangles.push_back(maths::triangle3d(maths::vector3d(-0.0, 7.0, 7.0), maths::vector3d(1.0, 7.0, 7.0), maths::vector3d(0.0, 8.0, 7.0)));
+		triangles.push_back(maths::triangle3d(maths::vector3d(0.0, 7.0, 7.0), maths::vector3d(0.0, 8.0, 7.0), maths::vector3d(-1.0, 7.0, 7.0)));
+
+		triangle_mesh mt_mesh;
+		mt_mesh.build(triangles, 4);
+
+		ensure_equals(mt_mesh.get_facets().size(), 292u);
+		ensure_equals(mt_mesh.get_vertices().size(), 146u + 1u + 4u);
+	}
 };
@@ -0,0 +1,103 @@
+/*
+ * stl_generate.cpp
+ *
+ * Writes a synthetic STL of (about) the requested number of facets, for scale testing.
+ *
+ * usage: stl_generate <shape> <num_facets> <output.stl> [--ascii] [--seed n] [--jitter d] [--name s]
+ *
+ * where shape is sphere, torus, grid, non_manifold or jittered_soup
+ */
+
+#include "stl_generator.h"
+#include "stl_exporter.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace
+{
+
+void usage()
+{
+	cerr << "usage: stl_generate <shape> <num_facets> <output.stl> [--ascii] [--seed n] [--jitter d] [--name s]" << endl
+		 << "  shape is sphere, torus, grid, non_manifold or jittered_soup" << endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		usage();
+		return 1;
+	}
+
+	stl_util::generated_shape shape;
+	if (!stl_util::stl_generator::parse_shape(argv[1], shape))
+	{
+		cerr << "Unknown shape: " << argv[1] << endl;
+		usage();
+		return 1;
+	}
+
+	const string filename = argv[3];
+	stl_util::stl_format format = stl_util::stl_format::binary;
+
+	try
+	{
+		const size_t num_facets = stoull(argv[2]);
+
+		std::uint64_t seed = 0;
+		double jitter = -1.0;	// the shape's default
+		string name;
+
+		for (int i = 4 ; i < argc ; i++)
+		{
+			const string arg = argv[i];
+
+			if (arg == "--ascii")
+				format = stl_util::stl_format::ascii;
+			else if (arg == "--seed" && i + 1 < argc)
+				seed = stoull(argv[++i]);
+			else if (arg == "--jitter" && i + 1 < argc)
+				jitter = stod(argv[++i]);
+			else if (arg == "--name" && i + 1 < argc)
+				name = argv[++i];
+			else
+			{
+				usage();
+				return 1;
+			}
+		}
+
+		stl_util::stl_generator generator(shape, num_facets, seed);
+		if (jitter >= 0.0)
+			generator.set_jitter(jitter);
+		if (!name.empty())
+			generator.name() = name;
+
+		ofstream stl_stream(filename, ios::binary);
+		if (!stl_stream.is_open())
+		{
+			cerr << "Error opening " << filename << endl;
+			return 1;
+		}
+
+		stl_util::stl_exporter(stl_stream, format).write(generator);
+
+		cout << "Wrote " << generator.num_facets() << " facet "
+			 << (format == stl_util::stl_format::binary ? "binary" : "ASCII") << " "
+			 << stl_util::stl_generator::shape_name(shape) << " to " << filename << endl;
+	}
+	catch (std::exception& e)
+	{
+		cerr << "Error: " << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}